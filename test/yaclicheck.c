@@ -0,0 +1,533 @@
+#include <stdio.h>
+#include <yacli.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+// non-interactive checks; screen output is recorded by the yascreen stand-in in test/yascreen.c
+
+static int checks=0;
+static int fails=0;
+static int nrows=0; // rows printed by show rows
+static int printed=0; // rows the command got to print before output was done
+
+#define CHECK(c) check(!!(c),#c,__FILE__,__LINE__)
+
+static void check(int ok,const char *what,const char *file,int line) {
+	checks++;
+	if (ok)
+		return;
+	fails++;
+	printf("%s:%d: check failed: %s\n",file,line,what);
+}
+
+static void cmd_rows(yacli *cli,int cnt,char **cmd) {
+	int i;
+
+	printed=0;
+	for (i=0;i<nrows;i++) {
+		if (yacli_print(cli,"row %d val%d\n",i,i%3)==YACLI_OUTPUT_DONE)
+			break;
+		printed++;
+	}
+}
+
+static void cmd_table(yacli *cli,int cnt,char **cmd) {
+	int i;
+
+	yacli_table_begin(cli);
+	yacli_table_col(cli,"name",0);
+	yacli_table_col(cli,"bytes",1);
+	for (i=0;i<nrows;i++) {
+		char b[32];
+
+		snprintf(b,sizeof b,"if\"%d,x",i);
+		yacli_table_str(cli,b);
+		yacli_table_uint(cli,i*100);
+		if (yacli_table_row(cli))
+			break;
+	}
+	yacli_table_end(cli);
+}
+
+static void cmd_hello(yacli *cli,int cnt,char **cmd) {
+	yacli_print(cli,"hello world\n");
+}
+
+static yacli *mkcli(yascreen *s) {
+	yacli *cli=yacli_init(s);
+	void *p;
+
+	yacli_set_hostname(cli,"h");
+	yacli_set_banner(cli,"");
+	yacli_set_more(cli,0);
+	p=yacli_add_cmd(cli,NULL,"show","Show",NULL);
+	yacli_add_cmd(cli,p,"rows","Rows",cmd_rows);
+	yacli_add_cmd(cli,p,"table","Table",cmd_table);
+	yacli_add_cmd(cli,NULL,"hello","Hello",cmd_hello);
+	return cli;
+}
+
+static void start(yacli *cli) {
+	yacli_start(cli);
+	yacli_keys(cli,NULL,0); // draw the prompt
+	yascreen_out_reset(yacli_get_screen(cli));
+}
+
+static void type(yacli *cli,const char *t) {
+	// one key at a time, \n is enter
+	for (;*t;t++)
+		yacli_key(cli,*t=='\n'?YAS_K_C_M:(unsigned char)*t);
+}
+
+static void run(yacli *cli,const char *cmd) {
+	// enter command and collect all of its output
+	yascreen_out_reset(yacli_get_screen(cli));
+	type(cli,cmd);
+	yacli_key(cli,YAS_K_C_M);
+	while (yacli_output_pending(cli)) {
+		yacli_output_drain(cli);
+		usleep(1000);
+	}
+}
+
+static const char *out(yacli *cli) {
+	return yascreen_out(yacli_get_screen(cli));
+}
+
+static int has(yacli *cli,const char *s) {
+	return !!strstr(out(cli),s);
+}
+
+static int cnt(yacli *cli,const char *s) {
+	const char *o=out(cli);
+	int n=0;
+
+	while ((o=strstr(o,s))) {
+		n++;
+		o+=strlen(s);
+	}
+	return n;
+}
+
+static int lines_eq(yacli *cli,const char *cmd,const char *exp) {
+	// output between the command echo and the next prompt is exactly exp
+	const char *o=out(cli);
+	const char *b=strstr(o,cmd);
+	const char *e;
+	int ok;
+
+	if (!b)
+		return 0;
+	b=strstr(b,"\r\n");
+	if (!b)
+		return 0;
+	b+=2;
+	e=strstr(b,"\x1b[2K\rh# ");
+	if (!e)
+		return 0;
+	ok=(size_t)(e-b)==strlen(exp)&&!memcmp(b,exp,e-b);
+	if (!ok)
+		printf("got [%.*s]\n",(int)(e-b),b);
+	return ok;
+}
+
+static void check_head(void) {
+	yascreen *s=yascreen_init(80,25);
+	yacli *cli=mkcli(s);
+
+	start(cli);
+	nrows=100000;
+	run(cli,"show rows | head 3");
+	CHECK(lines_eq(cli,"| head 3","row 0 val0\r\nrow 1 val1\r\nrow 2 val2\r\n"));
+	CHECK(printed<3); // third line has filled head, the command was told to stop
+
+	run(cli,"show rows | last 2");
+	CHECK(lines_eq(cli,"| last 2","row 99998 val2\r\nrow 99999 val0\r\n"));
+	CHECK(printed==nrows);
+
+	run(cli,"show rows | include 7 | head 2");
+	CHECK(lines_eq(cli,"| head 2","row 7 val1\r\nrow 17 val2\r\n"));
+	CHECK(printed==17);
+
+	yacli_set_more(cli,1);
+	run(cli,"show rows");
+	CHECK(has(cli,"<<< more >>>"));
+	CHECK(has(cli,"row 22 val1\r\n")&&!has(cli,"row 23 "));
+	yascreen_out_reset(s);
+	yacli_key(cli,' '); // next page
+	CHECK(has(cli,"row 23 val2\r\n")&&has(cli,"row 46 val1\r\n")&&!has(cli,"row 47 "));
+	yascreen_out_reset(s);
+	yacli_key(cli,'q'); // quit more, the rest of the output is dropped
+	CHECK(!has(cli,"row 47 "));
+	CHECK(has(cli,"\x1b[2K\rh# "));
+
+	run(cli,"show rows");
+	yascreen_out_reset(s);
+	yacli_key(cli,YAS_K_C_C); // ^C at more prompt drops it too
+	CHECK(!has(cli,"row "));
+	CHECK(has(cli,"^C"));
+	run(cli,"hello");
+	CHECK(lines_eq(cli,"hello","hello world\r\n"));
+
+	yacli_free(cli);
+	yascreen_free(s);
+}
+
+static int cmpstr(const void *a,const void *b) {
+	return strcmp(*(char **)a,*(char **)b);
+}
+
+static void check_sort(void) {
+	yascreen *s=yascreen_init(80,25);
+	yacli *cli=mkcli(s);
+	char *exp,**v;
+	size_t el=0;
+	int i;
+
+	start(cli);
+	yacli_set_sort_mem(cli,256); // a few lines per run, the rest is merged from temp files
+	nrows=500;
+
+	run(cli,"show rows | sort -n -r -k 2 | head 3");
+	CHECK(lines_eq(cli,"| head 3","row 499 val1\r\nrow 498 val0\r\nrow 497 val2\r\n"));
+
+	run(cli,"show rows | sort -k 3 | head 3");
+	CHECK(lines_eq(cli,"| head 3","row 0 val0\r\nrow 102 val0\r\nrow 105 val0\r\n")); // equal keys are ordered by the whole line
+
+	// plain sort of all lines, compared with qsort
+	v=malloc(nrows*sizeof *v);
+	exp=malloc(nrows*32);
+	for (i=0;i<nrows;i++) {
+		v[i]=malloc(32);
+		snprintf(v[i],32,"row %d val%d",i,i%3);
+	}
+	qsort(v,nrows,sizeof *v,cmpstr);
+	for (i=0;i<nrows;i++) {
+		el+=sprintf(exp+el,"%s\r\n",v[i]);
+		free(v[i]);
+	}
+	free(v);
+	run(cli,"show rows | sort");
+	CHECK(lines_eq(cli,"| sort",exp));
+	free(exp);
+
+	yascreen_out_reset(s);
+	type(cli,"show rows | sort -x\n");
+	CHECK(has(cli,"Invalid parameters for filter sort: -x"));
+	CHECK(!has(cli,"row 0"));
+
+	yacli_free(cli);
+	yascreen_free(s);
+}
+
+static void check_agg(void) {
+	yascreen *s=yascreen_init(80,25);
+	yacli *cli=mkcli(s);
+
+	start(cli);
+	nrows=7;
+	run(cli,"show rows | count-by 3 -s");
+	CHECK(lines_eq(cli,"| count-by 3 -s","      3 val0\r\n      2 val1\r\n      2 val2\r\n"));
+	run(cli,"show rows | count");
+	CHECK(lines_eq(cli,"| count","Line count: 7\r\n"));
+	nrows=3;
+	run(cli,"show rows | uniq -c");
+	CHECK(lines_eq(cli,"| uniq -c","      1 row 0 val0\r\n      1 row 1 val1\r\n      1 row 2 val2\r\n"));
+
+	yacli_free(cli);
+	yascreen_free(s);
+}
+
+static void check_format(void) {
+	yascreen *s=yascreen_init(80,25);
+	yacli *cli=mkcli(s);
+
+	start(cli);
+	nrows=2;
+	run(cli,"show table");
+	CHECK(lines_eq(cli,"show table","name    bytes\r\nif\"0,x      0\r\nif\"1,x    100\r\n"));
+	run(cli,"show table | json");
+	CHECK(lines_eq(cli,"| json","{\"name\":\"if\\\"0,x\",\"bytes\":0}\r\n{\"name\":\"if\\\"1,x\",\"bytes\":100}\r\n"));
+	run(cli,"show table | csv");
+	CHECK(lines_eq(cli,"| csv","name,bytes\r\n\"if\"\"0,x\",0\r\n\"if\"\"1,x\",100\r\n"));
+
+	CHECK(yacli_set_output_format(cli,"xml")==-1);
+	CHECK(yacli_set_output_format(cli,"csv")==0);
+	run(cli,"show table");
+	CHECK(lines_eq(cli,"show table","name,bytes\r\n\"if\"\"0,x\",0\r\n\"if\"\"1,x\",100\r\n"));
+
+	yacli_free(cli);
+	yascreen_free(s);
+}
+
+static void check_async(void) {
+	yascreen *s=yascreen_init(80,25);
+	yacli *cli=mkcli(s);
+
+	start(cli);
+	yacli_set_async_output(cli,1);
+	nrows=30;
+	run(cli,"show rows | include 2 | exclude 1");
+	CHECK(lines_eq(cli,"| exclude 1","row 2 val2\r\nrow 5 val2\r\nrow 8 val2\r\nrow 20 val2\r\nrow 23 val2\r\nrow 24 val0\r\nrow 26 val2\r\nrow 27 val0\r\nrow 29 val2\r\n"));
+
+	// keys typed while the filters are still busy are kept for the prompt
+	nrows=100000;
+	yascreen_out_reset(s);
+	type(cli,"show rows | sort -n -r -k 2 | head 1\nhello\n");
+	while (yacli_output_pending(cli)) {
+		yacli_output_drain(cli);
+		usleep(1000);
+	}
+	CHECK(lines_eq(cli,"| head 1","row 99999 val0\r\n"));
+	CHECK(lines_eq(cli,"h# hello","hello world\r\n"));
+	CHECK(cnt(cli,"hello world")==1);
+
+	run(cli,"show rows | head 2");
+	CHECK(lines_eq(cli,"| head 2","row 0 val0\r\nrow 1 val1\r\n"));
+	CHECK(printed<nrows); // the worker has told the command to stop
+
+	// ^C drops the output still in the filters and what was typed meanwhile
+	yascreen_out_reset(s);
+	type(cli,"show rows | sort\n");
+	type(cli,"hel");
+	yacli_key(cli,YAS_K_C_C);
+	while (yacli_output_pending(cli)) {
+		yacli_output_drain(cli);
+		usleep(1000);
+	}
+	CHECK(has(cli,"^C")&&!strstr(strstr(out(cli),"^C"),"row "));
+	CHECK(!strcmp(yacli_buf_get(cli),""));
+	run(cli,"hello");
+	CHECK(lines_eq(cli,"hello","hello world\r\n"));
+
+	yacli_free(cli);
+	yascreen_free(s);
+}
+
+static void check_hist(void) {
+	yascreen *s=yascreen_init(80,25);
+	yacli *cli=mkcli(s);
+	char b[32];
+	int i;
+
+	start(cli);
+	yacli_set_hist_size(cli,3);
+	for (i=0;i<5;i++) {
+		snprintf(b,sizeof b,"cmd %d",i);
+		yacli_add_hist(cli,b);
+	}
+	yacli_key(cli,YAS_K_UP);
+	CHECK(!strcmp(yacli_buf_get(cli),"cmd 4"));
+	yacli_key(cli,YAS_K_UP);
+	yacli_key(cli,YAS_K_UP);
+	CHECK(!strcmp(yacli_buf_get(cli),"cmd 2"));
+	yacli_key(cli,YAS_K_UP); // oldest kept one
+	CHECK(!strcmp(yacli_buf_get(cli),"cmd 2"));
+	yacli_key(cli,YAS_K_C_C);
+
+	// a repeated command moves to the newest place and takes no capacity
+	yacli_set_hist_size(cli,3);
+	yacli_set_hist_dedup(cli,1);
+	yacli_add_hist(cli,"A");
+	yacli_add_hist(cli,"B");
+	yacli_add_hist(cli,"A");
+	yacli_add_hist(cli,"B");
+	yacli_add_hist(cli,"A");
+	yacli_add_hist(cli,"B");
+	yacli_key(cli,YAS_K_UP);
+	CHECK(!strcmp(yacli_buf_get(cli),"B"));
+	yacli_key(cli,YAS_K_UP);
+	CHECK(!strcmp(yacli_buf_get(cli),"A"));
+	yacli_key(cli,YAS_K_UP);
+	CHECK(!strcmp(yacli_buf_get(cli),"cmd 4"));
+	yacli_key(cli,YAS_K_UP);
+	CHECK(!strcmp(yacli_buf_get(cli),"cmd 4"));
+	yacli_key(cli,YAS_K_C_C);
+
+	// up/down with typed prefix
+	yacli_set_hist_size(cli,100);
+	yacli_set_hist_prefix(cli,1);
+	yacli_add_hist(cli,"show a");
+	yacli_add_hist(cli,"ping x");
+	yacli_add_hist(cli,"show b");
+	yacli_add_hist(cli,"ping y");
+	type(cli,"sh");
+	yacli_key(cli,YAS_K_UP);
+	CHECK(!strcmp(yacli_buf_get(cli),"show b"));
+	yacli_key(cli,YAS_K_UP);
+	CHECK(!strcmp(yacli_buf_get(cli),"show a"));
+	yacli_key(cli,YAS_K_UP);
+	CHECK(!strcmp(yacli_buf_get(cli),"show a"));
+	yacli_key(cli,YAS_K_DOWN);
+	CHECK(!strcmp(yacli_buf_get(cli),"show b"));
+	yacli_key(cli,YAS_K_DOWN);
+	CHECK(!strcmp(yacli_buf_get(cli),"sh"));
+	yacli_key(cli,YAS_K_C_C);
+
+	yacli_free(cli);
+	yascreen_free(s);
+}
+
+static void check_hist_file(void) {
+	yascreen *s=yascreen_init(80,25);
+	yacli *cli=mkcli(s);
+	char fn[64],b[32];
+	struct stat st;
+	int i,n;
+
+	snprintf(fn,sizeof fn,"/tmp/yaclicheck.%d.hist",(int)getpid());
+	unlink(fn);
+	start(cli);
+	CHECK(!yacli_set_hist_file(cli,fn,256));
+	for (i=0;i<100;i++) {
+		snprintf(b,sizeof b,"cmd %d",i);
+		yacli_add_hist(cli,b);
+	}
+	yacli_free(cli);
+	CHECK(!stat(fn,&st)&&st.st_size<=256);
+
+	// new session loads what was kept by compaction, newest first and without gaps
+	cli=mkcli(s);
+	start(cli);
+	CHECK(!yacli_set_hist_file(cli,fn,256));
+	for (i=99;;i--) {
+		yacli_key(cli,YAS_K_UP);
+		snprintf(b,sizeof b,"cmd %d",i);
+		if (strcmp(yacli_buf_get(cli),b))
+			break;
+	}
+	CHECK(i<90&&i>0);
+	CHECK(sscanf(yacli_buf_get(cli),"cmd %d",&n)==1&&n==i+1); // stays at the oldest one
+	yacli_free(cli);
+	unlink(fn);
+	yascreen_free(s);
+}
+
+static void check_hist_shared(void) {
+	yascreen *sa=yascreen_init(80,25),*sb=yascreen_init(80,25);
+	yacli *a=mkcli(sa),*b=mkcli(sb);
+	char x[32];
+	int i;
+
+	CHECK(!yacli_set_hist_shared(a,1,NULL));
+	CHECK(!yacli_set_hist_shared(b,1,NULL));
+	start(a);
+	start(b);
+	yacli_add_hist(a,"a1");
+	yacli_add_hist(b,"b1");
+	yacli_add_hist(a,"a2");
+	yacli_key(b,YAS_K_UP);
+	CHECK(!strcmp(yacli_buf_get(b),"a2"));
+	yacli_key(b,YAS_K_UP);
+	CHECK(!strcmp(yacli_buf_get(b),"b1"));
+	yacli_key(b,YAS_K_UP);
+	CHECK(!strcmp(yacli_buf_get(b),"a1"));
+	yacli_key(b,YAS_K_C_C);
+
+	// other session has wrapped the ring many times
+	for (i=0;i<6000;i++) {
+		snprintf(x,sizeof x,"spam%d",i);
+		yacli_add_hist(a,x);
+	}
+	yacli_key(b,YAS_K_UP);
+	CHECK(!strcmp(yacli_buf_get(b),"spam5999"));
+	yacli_key(b,YAS_K_UP);
+	CHECK(!strcmp(yacli_buf_get(b),"spam5998"));
+
+	yacli_free(a);
+	yacli_free(b);
+	yascreen_free(sa);
+	yascreen_free(sb);
+}
+
+static void check_paste(void) {
+	yascreen *s=yascreen_init(80,25);
+	yacli *cli=mkcli(s);
+
+	start(cli);
+	yacli_set_paste_exec(cli,1);
+	nrows=2;
+	yacli_key(cli,YAS_K_ESC);
+	type(cli,"[200~show rows\nbogus\nshow rows | head 1\n");
+	yacli_key(cli,YAS_K_ESC);
+	type(cli,"[201~");
+	CHECK(has(cli,"\rrow 0 val0\r\nrow 1 val1\r\nrow 0 val0\r\nPasted 3 lines, 1 failed\r\n  line 2: bogus\r\n"));
+	yacli_key(cli,YAS_K_UP); // paste lines do not go to history
+	CHECK(!strcmp(yacli_buf_get(cli),""));
+
+	// without paste exec the rest of the paste waits for the more prompt
+	yacli_set_paste_exec(cli,0);
+	yacli_set_more(cli,1);
+	nrows=30;
+	yascreen_out_reset(s);
+	yacli_key(cli,YAS_K_ESC);
+	type(cli,"[200~show rows\nhello\n");
+	yacli_key(cli,YAS_K_ESC);
+	type(cli,"[201~");
+	CHECK(has(cli,"<<< more >>>"));
+	CHECK(!has(cli,"hello world"));
+	yacli_key(cli,'c');
+	CHECK(has(cli,"row 29 val2\r\n"));
+	CHECK(has(cli,"hello world\r\n"));
+
+	yacli_free(cli);
+	yascreen_free(s);
+}
+
+static void check_prompt(void) {
+	yascreen *s=yascreen_init(80,25);
+	yacli *cli=mkcli(s);
+
+	start(cli);
+	type(cli,"a");
+	CHECK(!strcmp(out(cli),"a"));
+	yascreen_out_reset(s);
+	type(cli,"bc");
+	CHECK(!strcmp(out(cli),"bc"));
+	yascreen_out_reset(s);
+	yacli_key(cli,YAS_K_LEFT);
+	yacli_key(cli,YAS_K_LEFT);
+	CHECK(!strcmp(out(cli),"\b\b"));
+	yascreen_out_reset(s);
+	yacli_key(cli,'X'); // insert in the middle
+	CHECK(!strcmp(out(cli),"\x1b[1@X"));
+	yascreen_out_reset(s);
+	yacli_key(cli,YAS_K_BSP); // delete in the middle
+	CHECK(!strcmp(out(cli),"\b\x1b[1P"));
+	yascreen_out_reset(s);
+	yacli_key(cli,YAS_K_END); // short move right rewrites the text
+	CHECK(!strcmp(out(cli),"bc"));
+	yascreen_out_reset(s);
+	yacli_key(cli,YAS_K_HOME);
+	CHECK(!strcmp(out(cli),"\x1b[3D"));
+	yascreen_out_reset(s);
+	yacli_key(cli,YAS_K_END);
+	CHECK(!strcmp(out(cli),"abc"));
+	yascreen_out_reset(s);
+	yacli_key(cli,YAS_K_C_U); // erase to line start
+	CHECK(!strcmp(out(cli),"\x1b[3D\x1b[K"));
+	yascreen_out_reset(s);
+	yacli_key(cli,YAS_K_C_L); // full redraw
+	CHECK(has(cli,"\x1b[2K\rh# \r\x1b[3C"));
+
+	yacli_free(cli);
+	yascreen_free(s);
+}
+
+int main(void) {
+	check_head();
+	check_sort();
+	check_agg();
+	check_format();
+	check_async();
+	check_hist();
+	check_hist_file();
+	check_hist_shared();
+	check_paste();
+	check_prompt();
+
+	printf("%d checks, %d failed\n",checks,fails);
+	return !!fails;
+}
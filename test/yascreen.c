@@ -0,0 +1,112 @@
+// stand-in for yascreen that records all output for the tests
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <yascreen.h>
+
+struct _yascreen {
+	char *out; // all output since last reset
+	size_t len; // out data len
+	size_t siz; // out alloc size
+	int sx,sy; // reported size
+};
+
+inline yascreen *yascreen_init(int sx,int sy) { // {{{
+	yascreen *s=calloc(1,sizeof *s);
+
+	if (!s)
+		return NULL;
+	s->sx=sx?sx:80;
+	s->sy=sy?sy:25;
+	return s;
+} // }}}
+
+inline const char *yascreen_ver(void) { // {{{
+	return "yascreen stand-in";
+} // }}}
+
+inline void yascreen_set_telnet(yascreen *s,int on) { // {{{
+} // }}}
+
+inline void yascreen_init_telnet(yascreen *s) { // {{{
+} // }}}
+
+inline int yascreen_write(yascreen *s,const char *str,int len) { // {{{
+	if (!s||len<0)
+		return -1;
+	if (s->len+len+1>s->siz) {
+		size_t ns=(s->len+len+1)*2;
+		char *t=realloc(s->out,ns);
+
+		if (!t)
+			return -1;
+		s->out=t;
+		s->siz=ns;
+	}
+	memcpy(s->out+s->len,str,len);
+	s->len+=len;
+	s->out[s->len]=0;
+	return len;
+} // }}}
+
+inline int yascreen_puts(yascreen *s,const char *str) { // {{{
+	return yascreen_write(s,str,strlen(str));
+} // }}}
+
+inline int yascreen_print(yascreen *s,const char *format,...) { // {{{
+	va_list ap;
+	char *p;
+	int n;
+
+	va_start(ap,format);
+	n=vasprintf(&p,format,ap);
+	va_end(ap);
+	if (n<0)
+		return n;
+	yascreen_write(s,p,n);
+	free(p);
+	return n;
+} // }}}
+
+inline const char *yascreen_clearln_s(yascreen *s) { // {{{
+	return "\x1b[2K";
+} // }}}
+
+inline void yascreen_clearln(yascreen *s) { // {{{
+	yascreen_puts(s,yascreen_clearln_s(s));
+} // }}}
+
+inline void yascreen_clear(yascreen *s) { // {{{
+} // }}}
+
+inline void yascreen_line_flush(yascreen *s,uint8_t on) { // {{{
+} // }}}
+
+inline void yascreen_reqsize(yascreen *s) { // {{{
+} // }}}
+
+inline void yascreen_getsize(yascreen *s,int *sx,int *sy) { // {{{
+	*sx=s->sx;
+	*sy=s->sy;
+} // }}}
+
+inline void yascreen_free(yascreen *s) { // {{{
+	if (!s)
+		return;
+	if (s->out)
+		free(s->out);
+	free(s);
+} // }}}
+
+inline const char *yascreen_out(yascreen *s) { // {{{
+	return s->out?s->out:"";
+} // }}}
+
+inline void yascreen_out_reset(yascreen *s) { // {{{
+	s->len=0;
+	if (s->out)
+		*s->out=0;
+} // }}}
@@ -0,0 +1,81 @@
+// stand-in for yascreen.h, only what yacli uses; output is recorded by test/yascreen.c
+
+#ifndef ___YASCREEN_H___
+#define ___YASCREEN_H___
+
+#include <stdint.h>
+#include <sys/types.h>
+
+typedef struct _yascreen yascreen;
+
+typedef enum {
+	YAS_K_NONE=-1,
+	YAS_K_NUL=0x00,
+	YAS_K_C_A,
+	YAS_K_C_B,
+	YAS_K_C_C,
+	YAS_K_C_D,
+	YAS_K_C_E,
+	YAS_K_C_F,
+	YAS_K_C_G,
+	YAS_K_C_H,
+	YAS_K_C_I,
+	YAS_K_C_J,
+	YAS_K_C_K,
+	YAS_K_C_L,
+	YAS_K_C_M,
+	YAS_K_C_N,
+	YAS_K_C_O,
+	YAS_K_C_P,
+	YAS_K_C_Q,
+	YAS_K_C_R,
+	YAS_K_C_S,
+	YAS_K_C_T,
+	YAS_K_C_U,
+	YAS_K_C_V,
+	YAS_K_C_W,
+	YAS_K_C_X,
+	YAS_K_C_Y,
+	YAS_K_C_Z,
+	YAS_K_ESC,
+	YAS_K_TAB=0x09,
+	YAS_K_RET=0x0d,
+	YAS_K_BSP=0x7f,
+	YAS_K_UP=0x100,
+	YAS_K_DOWN,
+	YAS_K_LEFT,
+	YAS_K_RIGHT,
+	YAS_K_HOME,
+	YAS_K_END,
+	YAS_K_DEL,
+	YAS_K_C_LEFT,
+	YAS_K_C_RIGHT,
+	YAS_K_A_BSP,
+	YAS_K_A_a=0x200,
+	YAS_K_A_b,
+	YAS_K_A_d,
+	YAS_K_A_f,
+	YAS_SCREEN_SIZE=0x800,
+	YAS_TELNET_SIZE,
+} yas_keys;
+
+yascreen *yascreen_init(int sx,int sy);
+const char *yascreen_ver(void);
+void yascreen_set_telnet(yascreen *s,int on);
+void yascreen_init_telnet(yascreen *s);
+int yascreen_write(yascreen *s,const char *str,int len);
+int yascreen_puts(yascreen *s,const char *str);
+int yascreen_print(yascreen *s,const char *format,...) __attribute__((format(printf,2,3)));
+const char *yascreen_clearln_s(yascreen *s);
+void yascreen_clearln(yascreen *s);
+void yascreen_clear(yascreen *s);
+void yascreen_line_flush(yascreen *s,uint8_t on);
+void yascreen_reqsize(yascreen *s);
+void yascreen_getsize(yascreen *s,int *sx,int *sy);
+void yascreen_free(yascreen *s);
+
+// test side: output written so far (NUL terminated) and reset of it
+const char *yascreen_out(yascreen *s);
+void yascreen_out_reset(yascreen *s);
+
+#endif
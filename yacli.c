@@ -28,12 +28,22 @@
 #endif
 
 #include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
 #include <regex.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
 
 #include <yacli.h>
 
@@ -42,6 +52,16 @@
 // {{{ definitions
 
 #define BUFFER_STEP 1024
+#define TABLE_WINDOW 64 // rows buffered to calculate table column widths
+#define SORT_MEM (16*1024*1024) // default memory budget for sort filter
+#define OPIPE_SIZE (64*1024) // ring and handback buffer size for threaded output, power of 2
+#define MSG_QUEUE (64*1024) // queued message bytes above which further messages are suppressed
+#define HIST_SIZE 1000 // default history capacity in commands
+#define PASTE_ERRS 10 // failed lines listed after executing a paste
+#define HSH_SLOTS 4096 // shared history entries, power of 2
+#define HSH_TEXT (256*1024) // shared history text area, power of 2
+#define HSH_MAGIC 0x5943484953543031ull // shared history is initialized
+#define HSH_INIT 1 // shared history is being initialized
 
 #define mymax(a,b) (((a)>(b))?(a):(b))
 #define mymin(a,b) (((a)<(b))?(a):(b))
@@ -51,6 +71,9 @@ typedef enum {
 	IN_SEARCH, // incremental search in history
 	IN_MORE, // more prompt, used for paging
 	IN_C_X, // Ctrl-X sequence
+	IN_ESC, // ESC in normal input, may start bracketed paste
+	IN_PASTE, // bracketed paste, text is collected until end marker
+	IN_OUTPUT, // command is done, its output still comes from the filter worker; keys are typed ahead
 } yacli_in_state;
 
 typedef struct _cmnode {
@@ -71,22 +94,87 @@ typedef struct _cmstack {
 	cmnode *cmdt; // previous command tree
 	char *mode; // current mode short name
 	void *hint; // user hint for the current mode
+	int modeoff; // modes len before this mode was added
 } cmstack;
 
-typedef struct _history {
-	struct _history *next; // next item in command history
-	struct _history *prev; // previous item in command history
-	char *command; // command text
-} history;
+typedef struct _hslot {
+	const char *ext; // command text in mapped history file (not zero terminated), NULL when in arena
+	size_t off; // offset of zero terminated command text in arena
+	int len; // command text len
+	int hnext; // next slot in the same dedup hash bucket, -1 for none
+	int prev; // slot of previous (older) command, -1 for none
+	int next; // slot of next (newer) command, -1 for none; next free slot for free slots
+	int tnode; // prefix trie node of the command text, -1 when not indexed
+	unsigned hash; // command text hash, valid in dedup mode
+	uint64_t id; // command id, grows with each added or repeated command; 0 for free slot
+} hslot;
+
+typedef struct _hidxref {
+	uint64_t id; // command id, the entry is stale when its slot has another id
+	int slot; // history slot of the command
+} hidxref;
+
+typedef struct _htnode {
+	hidxref *ref; // commands starting with the node prefix, oldest first
+	uint64_t last; // id of newest command with exactly the node prefix as text, 0 for none
+	int child; // first child node, -1 for none
+	int sib; // next sibling node, -1 for none
+	int n; // ref data len
+	int siz; // ref alloc size
+	unsigned char ch; // last byte of the node prefix
+} htnode;
+
+typedef struct _msgnode {
+	struct _msgnode *next; // next posted message (older)
+	char *text; // message text, allocated with the node
+} msgnode;
+
+typedef struct _hshslot {
+	uint64_t seq; // 2*n+1 while entry n is written, 2*n+2 when it is complete
+	uint64_t off; // text offset, wraps in text area
+	uint64_t owner; // session that added the command
+	uint32_t len; // command text len
+	uint32_t pad;
+} hshslot;
+
+typedef struct _hshm {
+	uint64_t magic; // HSH_MAGIC when ready
+	uint64_t seq; // next entry sequence number
+	uint64_t toff; // next text offset
+	uint64_t owners; // session id source
+	uint32_t nslot; // entry slots, power of 2; followed by slots and text area
+	uint32_t tsiz; // text area size, power of 2
+} hshm;
+
+typedef struct _table {
+	char **name; // column names
+	int *width; // column widths, only grow between windows
+	uint8_t *right; // column is right aligned
+	int *cell; // cell text offsets in arena, ncol per row
+	uint8_t *num; // cell is a number, ncol per row
+	char *arena; // zero terminated cell texts
+	char *line; // rendered output for a window of rows
+	int ncol; // column count
+	int colsiz; // column arrays alloc size
+	int cellsiz; // cell array alloc size
+	int arenasiz; // arena alloc size
+	int arenalen; // arena data len
+	int linesiz; // line alloc size
+	int rows; // complete rows in window
+	int cur; // cells in current row
+	uint8_t header:1; // header is already printed
+} table;
 
 typedef struct _filter_inst {
 	struct _filter_inst *next; // next filter instance (will receive our output)
 	struct _filter *fltr; // filter class
 	long private[4]; // private data, used for filter state
+	void *pdata; // private data, released by filter clean callback
 	char *params; // command line parameters of the filter
 	char *buf; // buffer used to process output by lines
 	int bufsiz; // buffer allocation size
 	int buflen; // buffer content length
+	uint8_t full:1; // needs no more input (e.g. head has all its lines)
 } filter_inst;
 
 typedef struct _filter {
@@ -95,7 +183,11 @@ typedef struct _filter {
 	char *cmd; // filter command word
 	char *help; // filter help text
 	int (*feed)(filter_inst *flti,const char *line,int len); // callback for text feed
+	int (*feedv)(filter_inst *flti,const struct iovec *iov,int iovcnt); // callback for fragmented text feed (optional)
 	void (*done)(filter_inst *flti); // callback to flush buffered stuff
+	void (*clean)(filter_inst *flti); // callback to free private data (optional)
+	int (*row)(filter_inst *flti,table *t,int r); // callback for table rows as records, skips text layout (optional, first filter only)
+	int (*check)(const char *params); // callback to validate parameters before the command runs, non-zero rejects them (optional)
 	uint8_t allownext:1; // allow chaining other filters afterwards
 } filter;
 
@@ -106,20 +198,39 @@ struct _yacli {
 	char *buffer; // current command buffer
 	char *savbuf; // saved buffer, while browsing history
 	char *sbuf; // incremental search buffer
-	char *rcmd; // search result pointer to command
+	int *scand; // search candidates, history slots of matching commands, newest first
+	int *hbucket; // dedup hash buckets of history slots, NULL when dedup is off
+	htnode *htrie; // prefix trie of history commands, node 0 is the empty prefix
+	hshm *hsh; // shared history, NULL when not shared
+	char *hshbuf; // command copied from shared history
+	const char *rcmd; // search result pointer to command (not zero terminated)
 	char *morebuf; // buffered data for more
 	char *moreprompt; // more prompt text
+	char *fmtbuf; // reusable buffer for formatted print
+	char *outbuf; // staging buffer for terminal output
+	char *pastebuf; // bracketed paste text collected so far
+	int *tkeys; // keys typed while command output was pending
+	char *scrbuf; // prompt line as it is on screen
+	char *scrnew; // prompt line being rendered
+	char *msgbuf; // queued messages, starts with room for prompt clear
+	msgnode *inq; // messages posted from other threads, lock free stack, newest first
 	char **parsedcmd; // command split into words (main style)
 	void *phint; // user defined hint (pointer)
 	cmnode *cmdt; // command tree
 	cmstack *cstack; // command stack with modes
-	char *modes; // all modes from stack
+	table *tbl; // table output of current command
+	char *modes; // all modes from stack, "(mode1-mode2)"
+	char *pfx; // prompt prefix: hostname, modes and level
 	filter noopf; // noop passthrough filter
+	filter asyncf; // sink that hands filtered output back from the worker thread
+	filter *outfmt; // session output format filter (json/csv), put first in the chain of each command
 	filter_inst noopi; // noop filter instance
 	filter *flts; // sorted defined filter list
 	filter_inst *fcmd; // applied filters for current command
-	history *hst; // command history (double linked)
-	history *hst_p; // pointer in history, NULL when not in history
+	hslot *hst; // command history, hstcap slots linked from oldest (hsthead) to newest (hsttail)
+	char *harena; // history command texts in order of adding, texts of evicted commands stay until repack
+	char *hpath; // history file, NULL for none
+	char *hmap; // history file contents mapped at load
 	yascreen *s; // screen used to render output
 	void (*cmdcb)(yacli *cli,const char *cmd,int code); // callback for each executed command
 	void (*listcb)(yacli *cli,void *ctx,int code); // callback for getting dynamic list items
@@ -127,16 +238,80 @@ struct _yacli {
 	void (*ctrlzcb)(yacli *cli); // user callback to notify ctrl-z
 	yacli_in_state state; // input bytestream DFA state
 	yacli_loop retcode; // bytestream feed return code
+	size_t sortmem; // memory budget for sort filter, sorted runs go to temp files above it
+	struct _opipe *opipe; // threaded output pipeline of current command
+	int outdone; // command output is cancelled (more quit, ^C); atomic
+	int infull; // first filter needs no more input, command may stop producing; atomic, worker thread sets it
 	int hint; // user defined hint (scalar)
-	int rpos; // matching command index where (0=first matching, 1=previous, etc)
+	int rpos; // current candidate in scand (0=first matching, 1=previous, etc)
+	int scandn; // search candidate count
+	int scandsiz; // scand alloc size
+	int ssiz; // sbuf alloc size
+	int slen; // sbuf data len
+	int harenalen; // harena data len
+	int harenalive; // harena bytes used by commands in history
+	int harenasiz; // harena alloc size
+	int hstcap; // history capacity in commands
+	int hsthead; // slot of oldest command, -1 for none
+	int hsttail; // slot of newest command, -1 for none
+	int hstfree; // first free slot, -1 for none
+	int hstcnt; // commands in history
+	int hst_p; // slot of shown history command, -1 when not in history
+	uint64_t hstseq; // id of newest command
+	uint64_t htrieend; // commands with higher id are not in htrie yet
+	int htrien; // htrie data len
+	int htriesiz; // htrie alloc size
+	int htrieref; // refs in all trie nodes
+	int htrielive; // refs in all trie nodes that are not stale
+	int hpfxnode; // trie node of the typed text while browsing by prefix, -1 when browsing all commands
+	int hpfxlen; // typed text len while browsing by prefix
+	int hpfx_p; // ref of current candidate in hpfxnode
+	size_t hmapsiz; // hmap len
+	size_t hfsize; // history file size
+	size_t hfmax; // history file size that triggers compaction, 0 for no limit
+	int hfd; // history file append fd, -1 for none
+	int hmapcnt; // history slots that point into hmap
+	int hbucketn; // hbucket count, power of 2
+	size_t hshsiz; // hsh mapping size
+	uint64_t hshseq; // next shared history entry to read
+	uint64_t hshid; // own session id in shared history
+	int hshbufsiz; // hshbuf alloc size
+	int rcmdlen; // rcmd len
 	int sx,sy; // terminal size
+	int modeslen; // modes data len
+	int modessiz; // modes alloc size
+	int pfxlen; // pfx data len
+	int pfxsiz; // pfx alloc size
+	int dspace; // buffer chars that fit after the prompt
 	int lines; // line count between prompts, used for pagination
 	int bufpos; // buffer left scroll position
 	int buflen; // buffer data len (may not always be 0 terminated)
+	int gappos; // buffer position of the edit gap
+	int gap; // edit gap len, text after the gap follows at gappos+gap; 0 when buffer is contiguous
 	int bufsiz; // buffer size
 	int cursor; // cursor position
 	int morelen; // morebuf data len
 	int moresiz; // morebuf alloc size
+	int fmtsiz; // fmtbuf alloc size
+	int outsiz; // outbuf alloc size
+	int pastelen; // pastebuf data len
+	int pastesiz; // pastebuf alloc size
+	int pastem; // matched len of bracketed paste start/end marker
+	int scrlen; // scrbuf data len
+	int scrsiz; // scrbuf alloc size
+	int scrnewlen; // scrnew data len
+	int scrnewsiz; // scrnew alloc size
+	int scrcur; // cursor column on screen
+	int msgsiz; // msgbuf alloc size
+	int msglen; // msgbuf data len
+	int msgrate; // max messages per second, 0 for unlimited
+	int msgwin; // messages in current second
+	int msgsupp; // messages suppressed since last flush
+	time_t msgsec; // current rate limit second
+	int msgfd; // signalled when inq becomes non-empty, -1 for none
+	int outfd; // signalled when output worker has handed back output or finished, -1 for none
+	int tkeyn; // tkeys data len
+	int tkeysiz; // tkeys alloc size
 	int parsedcnt; // parsed command word count
 	int parsedsiz; // parsed command array size
 	uint8_t more:1; // enable paged output
@@ -152,6 +327,17 @@ struct _yacli {
 	uint8_t clearmoreq:1; // clear more prompt after quit
 	uint8_t handlectrlz:1; // process ctrl-z shortcut
 	uint8_t ctrlzexeccmd:1; // when ctrl-z is hit, execute command in buffer
+	uint8_t asyncout:1; // run output filters in a worker thread
+	uint8_t msgbatch:1; // queue messages until yacli_message_flush
+	uint8_t hdedup:1; // keep only newest copy of each command in history
+	uint8_t hprefix:1; // up/down only browse commands starting with the typed text
+	uint8_t hshanon:1; // hsh is the process wide anonymous mapping
+	uint8_t chaindone:1; // done was already called on the filter chain
+	uint8_t inbatch:1; // inside yacli_keys, prompt redraw is done once after the batch
+	uint8_t pastexec:1; // execute multi-line pastes without echo and history
+	uint8_t pxrun:1; // executing paste lines, command parse messages are not shown
+	uint8_t pastewait:1; // rest of the paste is in pastebuf until command output ends (more prompt, filter worker)
+	uint8_t scrok:1; // screen shows scrbuf and cursor is at scrcur, prompt can be updated in place
 };
 
 typedef enum {
@@ -196,6 +382,26 @@ inline yascreen *yacli_get_screen(yacli *cli) { // {{{
 	return cli->s;
 } // }}}
 
+static inline int yacli_outdone(yacli *cli) { // {{{
+	// filters may run in a worker thread while the command produces output
+	return __atomic_load_n(&cli->outdone,__ATOMIC_RELAXED);
+} // }}}
+
+static inline void yacli_outdone_set(yacli *cli,int v) { // {{{
+	__atomic_store_n(&cli->outdone,v,__ATOMIC_RELAXED);
+} // }}}
+
+static inline int yacli_nomore(yacli *cli) { // {{{
+	// command can stop producing: output is cancelled or filters have all the input they need
+	return yacli_outdone(cli)||__atomic_load_n(&cli->infull,__ATOMIC_RELAXED);
+} // }}}
+
+static inline void yacli_infull_check(yacli *cli) { // {{{
+	// called by whoever feeds the chain, only the first filter decides for the command
+	if (cli->fcmd&&cli->fcmd->full)
+		__atomic_store_n(&cli->infull,1,__ATOMIC_RELAXED);
+} // }}}
+
 static inline int yacli_regx(const char *reg,const char *str) { // {{{
 	regex_t re;
 	int ret;
@@ -227,8 +433,11 @@ static inline int yacli_buf_inc(char **buf,int *siz,int *len,int add) { // {{{
 		return 0; // ok
 	if (*siz<=*len+add) { // need to realloc
 		int alloclen=*siz+(*len/BUFFER_STEP+1)*BUFFER_STEP;
-		char *n=calloc(1,alloclen);
+		char *n;
 
+		while (alloclen<=*len+add) // big chunk may not fit in a single step
+			alloclen+=BUFFER_STEP;
+		n=calloc(1,alloclen);
 		if (!n) // no free mem, nothing more to do
 			return -1;
 
@@ -242,79 +451,187 @@ static inline int yacli_buf_inc(char **buf,int *siz,int *len,int add) { // {{{
 	return 0;
 } // }}}
 
-static inline void yacli_wr_buf(yacli *cli,const char *data,size_t len) { // {{{
-	if (!cli)
+static inline void yacli_buf_flat(yacli *cli) { // {{{
+	// close the edit gap, buffer text becomes contiguous
+	if (!cli->gap)
 		return;
+	memmove(cli->buffer+cli->gappos,cli->buffer+cli->gappos+cli->gap,cli->buflen-cli->gappos);
+	cli->gap=0;
+} // }}}
 
-	if (yacli_buf_inc(&cli->morebuf,&cli->moresiz,&cli->morelen,len)) // alloc error
-		return;
+static inline int yacli_buf_gap(yacli *cli,int pos,int need) { // {{{
+	// move the edit gap to pos with room for need chars; moves only the text between old and new position
+	if (!cli->gap)
+		cli->gappos=pos;
+	if (cli->gap<need) { // grow with the line, so refills are amortized
+		int ng=mymax(need,cli->buflen/2+BUFFER_STEP);
 
-	if (len==0) // noop
-		return;
+		if (cli->buflen+ng>cli->bufsiz) {
+			char *t=realloc(cli->buffer,cli->buflen+ng);
+
+			if (!t)
+				return -1;
+			cli->buffer=t;
+			cli->bufsiz=cli->buflen+ng;
+		}
+		memmove(cli->buffer+cli->gappos+ng,cli->buffer+cli->gappos+cli->gap,cli->buflen-cli->gappos);
+		cli->gap=ng;
+	}
+	if (pos<cli->gappos)
+		memmove(cli->buffer+pos+cli->gap,cli->buffer+pos,cli->gappos-pos);
+	else if (pos>cli->gappos)
+		memmove(cli->buffer+cli->gappos,cli->buffer+cli->gappos+cli->gap,pos-cli->gappos);
+	cli->gappos=pos;
+	return 0;
+} // }}}
 
-	memcpy(cli->morebuf+cli->morelen,data,len);
-	cli->morelen+=len;
+static inline char yacli_bufc(yacli *cli,int pos) { // {{{
+	// buffer char at pos, 0 past the end
+	if (pos>=cli->buflen)
+		return 0;
+	return cli->buffer[pos<cli->gappos?pos:pos+cli->gap];
 } // }}}
 
-static inline int yacli_write_more(yacli *cli,const char *s,size_t len) { // {{{
+static inline int yacli_wr_xlat(char **buf,int *siz,int *len,const char *s,size_t slen,char prev) { // {{{
+	// append data to buffer, converting \n to \r\n; prev is the char that was before s
+	// return 0 on success, non-zero on error
 	size_t i;
 
-	if (!cli)
+	if (yacli_buf_inc(buf,siz,len,slen*2)) // worst case is all new lines
 		return -1;
 
-	if (cli->more&&!cli->buffered&&cli->lines+1>=cli->sy) { // if last command was exact but didn't toggle more prompt, do that now
-		cli->lines=0;
-		cli->redraw=1;
-		cli->buffered=1;
-		cli->state=IN_MORE;
+	for (i=0;i<slen;i++) {
+		if (s[i]=='\n'&&prev!='\r') // add \r only when the sequence is not already there
+			(*buf)[(*len)++]='\r';
+		(*buf)[(*len)++]=s[i];
+		prev=s[i];
 	}
+	return 0;
+} // }}}
+
+static inline void yacli_more_start(yacli *cli) { // {{{
+	if (!cli)
+		return;
+
+	cli->lines=0;
+	cli->redraw=1;
+	cli->buffered=1;
+	cli->state=IN_MORE;
+} // }}}
+
+static inline int yacli_write_nofv(yacli *cli,const struct iovec *iov,int iovcnt) { // {{{
+	size_t total=0;
+	char prev=0;
+	int ol=0;
+	int k;
+
+	if (!cli)
+		return -1;
+
+	cli->scrok=0; // output moves away from prompt line
+	for (k=0;k<iovcnt;k++)
+		total+=iov[k].iov_len;
+
+	if (cli->more&&!cli->buffered&&cli->lines+1>=cli->sy) // if last command was exact but didn't toggle more prompt, do that now
+		yacli_more_start(cli);
 
 	if (cli->buffered) { // append to buffer in buffered mode
-		yacli_wr_buf(cli,s,len);
-		return len;
+		for (k=0;k<iovcnt;k++)
+			if (iov[k].iov_len) {
+				yacli_wr_xlat(&cli->morebuf,&cli->moresiz,&cli->morelen,iov[k].iov_base,iov[k].iov_len,prev);
+				prev=((const char *)iov[k].iov_base)[iov[k].iov_len-1];
+			}
+		return total;
 	}
 
-	for (i=0;i<len;i++) { // count lines
-		if (s[i]=='\n')
+	// convert \n to \r\n and count lines in a single pass into the staging buffer
+	if (yacli_buf_inc(&cli->outbuf,&cli->outsiz,&ol,total*2)) // no memory
+		return -1;
+
+	for (k=0;k<iovcnt;k++) {
+		const char *s=iov[k].iov_base;
+		size_t i,len=iov[k].iov_len;
+
+		for (i=0;i<len;i++) {
+			if (s[i]!='\n') {
+				cli->outbuf[ol++]=s[i];
+				prev=s[i];
+				continue;
+			}
+			if (prev!='\r') // just in case the sequence is already there
+				cli->outbuf[ol++]='\r';
+			cli->outbuf[ol++]='\n';
+			prev='\n';
 			cli->lines++;
-		if (cli->more&&cli->lines+1>=cli->sy) { // if exceeded, do partial output and switch to buffered mode
-			yascreen_write(cli->s,s,i+1);
-			if (len>i+1) { // switch to more mode, only if there is more text
-				cli->lines=0;
-				cli->redraw=1;
-				cli->buffered=1;
-				cli->state=IN_MORE;
-				yacli_wr_buf(cli,s+i+1,len-i-1);
+			if (cli->more&&cli->lines+1>=cli->sy) { // if exceeded, do partial output and switch to buffered mode
+				yascreen_write(cli->s,cli->outbuf,ol);
+				if (len>i+1) { // buffer the rest of this fragment
+					yacli_more_start(cli);
+					yacli_wr_xlat(&cli->morebuf,&cli->moresiz,&cli->morelen,s+i+1,len-i-1,prev);
+					prev=s[len-1];
+				}
+				for (k++;k<iovcnt;k++) // and all following fragments
+					if (iov[k].iov_len) {
+						if (!cli->buffered)
+							yacli_more_start(cli);
+						yacli_wr_xlat(&cli->morebuf,&cli->moresiz,&cli->morelen,iov[k].iov_base,iov[k].iov_len,prev);
+						prev=((const char *)iov[k].iov_base)[iov[k].iov_len-1];
+					}
+				return total;
 			}
-			return len;
 		}
 	}
 
-	yascreen_write(cli->s,s,len);
+	if (ol)
+		yascreen_write(cli->s,cli->outbuf,ol);
 
-	return len;
+	return total;
 } // }}}
 
 static inline int yacli_write_nof(yacli *cli,const char *s,size_t len) { // {{{
-	size_t i,j=0;
+	struct iovec iov;
 
-	if (!cli)
+	iov.iov_base=(void *)s;
+	iov.iov_len=len;
+	return yacli_write_nofv(cli,&iov,1);
+} // }}}
+
+static inline int yacli_filter_feedv(filter_inst *fltr,const struct iovec *iov,int iovcnt) { // {{{
+	// pass fragments to filter; use vectored feed when filter has one
+	int total=0;
+	int k;
+
+	if (!fltr)
+		return -1;
+	if (!fltr->fltr)
 		return -1;
+	if (fltr->full)
+		return YACLI_OUTPUT_DONE;
 
-	for (i=0;i<len;i++) {
-		if (s[i]=='\n') { // process a new line
-			if (i&&s[i-1]=='\r') { // just in case the sequence is already there
-				yacli_write_more(cli,s+j,i-j+1);
-			} else { // convert \n to \r\n
-				yacli_write_more(cli,s+j,i-j);
-				yacli_write_more(cli,"\r\n",2);
-			}
-			j=i+1;
-		}
+	if (fltr->fltr->feedv)
+		return fltr->fltr->feedv(fltr,iov,iovcnt);
+	if (!fltr->fltr->feed)
+		return -1;
+
+	for (k=0;k<iovcnt;k++) {
+		if (fltr->full||yacli_outdone(fltr->fltr->cli))
+			return YACLI_OUTPUT_DONE;
+		if (iov[k].iov_len)
+			fltr->fltr->feed(fltr,iov[k].iov_base,iov[k].iov_len);
+		total+=iov[k].iov_len;
 	}
-	if (j<len)
-		yacli_write_more(cli,s+j,len-j);
-	return len;
+	return total;
+} // }}}
+
+static inline int yacli_filter_feedv_noop(filter_inst *fltr,const struct iovec *iov,int iovcnt) { // {{{
+	if (!fltr)
+		return -1;
+	if (!fltr->fltr)
+		return -1;
+	if (!fltr->fltr->cli)
+		return -1;
+
+	return yacli_write_nofv(fltr->fltr->cli,iov,iovcnt);
 } // }}}
 
 static inline int yacli_filter_feed_noop(filter_inst *fltr,const char *line,int len) { // {{{
@@ -386,15 +703,22 @@ static inline void yacli_add_fcmd(yacli *cli,filter *fltr,char *params) { // {{{
 static inline void yacli_free_fcmd(yacli *cli) { // {{{
 	if (!cli)
 		return;
+	if (cli->opipe) // chain is used by the filter worker, it is freed when the worker ends
+		return;
 
-	if (cli->fcmd&&cli->fcmd->fltr&&cli->fcmd->fltr->done)
+	if (!cli->chaindone&&cli->fcmd&&cli->fcmd->fltr&&cli->fcmd->fltr->done)
 		cli->fcmd->fltr->done(cli->fcmd);
+	cli->chaindone=0;
+	yacli_outdone_set(cli,0); // cancel ends with the output chain
+	__atomic_store_n(&cli->infull,0,__ATOMIC_RELAXED); // next command feeds a new chain
 	while (cli->fcmd) {
 		filter_inst *t;
 
 		t=cli->fcmd;
 		cli->fcmd=cli->fcmd->next;
 		if (t!=&cli->noopi) {
+			if (t->fltr&&t->fltr->clean)
+				t->fltr->clean(t);
 			if (t->buf)
 				free(t->buf);
 			if (t->params)
@@ -405,7 +729,7 @@ static inline void yacli_free_fcmd(yacli *cli) { // {{{
 	yacli_add_fcmd_s(cli,&cli->noopi);
 } // }}}
 
-static inline void *yacli_add_filter(yacli *cli,const char *cmd,const char *help,int (*feed)(filter_inst *flti,const char *line,int len),void (*done)(filter_inst *flti),int allownext) { // {{{
+static inline void *yacli_add_filter(yacli *cli,const char *cmd,const char *help,int (*feed)(filter_inst *flti,const char *line,int len),int (*feedv)(filter_inst *flti,const struct iovec *iov,int iovcnt),void (*done)(filter_inst *flti),void (*clean)(filter_inst *flti),int allownext) { // {{{
 	filter **place,*t;
 
 	if (!cli)
@@ -435,13 +759,22 @@ static inline void *yacli_add_filter(yacli *cli,const char *cmd,const char *help
 	t->help=strdup(help?help:"");
 	t->allownext=!!allownext;
 	t->feed=feed;
+	t->feedv=feedv;
 	t->done=done;
+	t->clean=clean;
 	t->next=*place;
 	*place=t;
 
 	return t;
 } // }}}
 
+static inline int yacli_filter_full(filter_inst *fltr) { // {{{
+	// next filter wants no more input, so neither do we; cancel stops the whole chain
+	if (fltr->next&&fltr->next->full)
+		fltr->full=1;
+	return fltr->full||yacli_outdone(fltr->fltr->cli);
+} // }}}
+
 static inline int yacli_filter_feed_include(filter_inst *fltr,const char *line,int len) { // {{{
 	int i;
 
@@ -472,6 +805,10 @@ redo:
 			if (strstr(fltr->buf,fltr->params)) { // pass the line
 				fltr->buf[i]='\n';
 				fltr->next->fltr->feed(fltr->next,fltr->buf,i+1);
+				if (yacli_filter_full(fltr)) { // next filters do not need more
+					fltr->buflen=0;
+					return YACLI_OUTPUT_DONE;
+				}
 			}
 			if (i+1<fltr->buflen)
 				memmove(fltr->buf,fltr->buf+i+1,fltr->buflen-i-1);
@@ -532,6 +869,10 @@ redo:
 			if (!strstr(fltr->buf,fltr->params)) { // pass the line
 				fltr->buf[i]='\n';
 				fltr->next->fltr->feed(fltr->next,fltr->buf,i+1); // pass error code
+				if (yacli_filter_full(fltr)) { // next filters do not need more
+					fltr->buflen=0;
+					return YACLI_OUTPUT_DONE;
+				}
 			}
 			if (i+1<fltr->buflen)
 				memmove(fltr->buf,fltr->buf+i+1,fltr->buflen-i-1);
@@ -575,6 +916,19 @@ static inline int yacli_filter_feed_count(filter_inst *fltr,const char *line,int
 	return len;
 } // }}}
 
+static inline int yacli_filter_feedv_count(filter_inst *fltr,const struct iovec *iov,int iovcnt) { // {{{
+	int total=0;
+	int k;
+
+	if (!fltr)
+		return -1;
+
+	for (k=0;k<iovcnt;k++)
+		total+=yacli_filter_feed_count(fltr,iov[k].iov_base,iov[k].iov_len);
+
+	return total;
+} // }}}
+
 static inline void yacli_filter_done_count(filter_inst *fltr) { // {{{
 	char s[200];
 
@@ -596,642 +950,3409 @@ static inline void yacli_filter_done_count(filter_inst *fltr) { // {{{
 	return;
 } // }}}
 
-inline yacli *yacli_init(yascreen *s) { // {{{
-	yacli *cli=calloc(1,sizeof *cli);
-
-	if (!cli)
-		return NULL;
+static inline int yacli_filter_num(const char *params,int def) { // {{{
+	// return -1 when params are not a line count
+	char *e;
+	long n;
 
-	if (!s) {
-		free(cli);
-		return NULL;
-	}
+	if (!params||!*params)
+		return def;
 
-	cli->s=s;
-	// we use explicit flush, tell yascreen not to do it
-	yascreen_line_flush(cli->s,0);
+	n=strtol(params,&e,10);
+	if (*e||n<0||n>INT_MAX) // not a sane line count
+		return -1;
 
-	if (myver[0]==0) { // reformat the static version string
-		char *rev=strstr(myver+1,"$Revision: ");
-		int vermaj,vermin;
+	return n;
+} // }}}
 
-		if (rev) {
-			sscanf(rev+strlen("$Revision: "),"%d.%d",&vermaj,&vermin);
-			vermaj+=vermin/100;
-			vermin=vermin%100;
-			memmove(myver,myver+1,strlen(myver+1)+1);
-			snprintf(rev-1,sizeof myver-(rev-1-myver),"%d.%02d\n\n",vermaj,vermin);
-		}
-	}
+static inline int yacli_filter_check_num(const char *params) { // {{{
+	return yacli_filter_num(params,0)<0;
+} // }}}
 
-	cli->hostname=strdup("none");
-	if (!cli->hostname)
-		goto allocerror;
-	cli->cstack=NULL;
-	cli->modes=NULL;
-	cli->moreprompt=strdup("<<< more >>> [ enter=line | space=page | c=continue | q=quit ] <<< more >>>");
-	if (!cli->moreprompt)
-		goto allocerror;
-	cli->level=strdup("#");
-	if (!cli->level)
-		goto allocerror;
-	cli->banner=strdup(myver);
-	if (!cli->banner)
-		goto allocerror;
-	cli->sx=80;
-	cli->sy=25;
-	cli->buffer=malloc(BUFFER_STEP);
-	if (!cli->buffer)
-		goto allocerror;
-	cli->bufsiz=BUFFER_STEP;
-	cli->buflen=0;
-	cli->bufpos=0;
-	cli->cursor=0;
-	cli->state=IN_NORM;
-	cli->redraw=1;
-	cli->retcode=YACLI_LOOP;
-	cli->istelnet=0;
-	cli->showtsize=0;
-	cli->rcmd=NULL;
-	cli->rpos=0;
-	cli->wastab=0;
-	cli->lines=0;
-	cli->morebuf=strdup("");
-	if (!cli->morebuf)
-		goto allocerror;
-	cli->morelen=0;
-	cli->moresiz=0;
-	cli->more=1; // use paged output by default
-	cli->clearmorel=1; // remove more prompt when showing next line
-	cli->clearmoreq=0; // leave more prompt when quit is pressed
-	cli->clearmorec=1; // remove more prompt when continue to end of output
-	cli->clearmorep=0; // leave more prompt only after whole page for clarity
-	cli->parsedcmd=NULL;
-	cli->parsedcnt=0;
-	cli->parsedsiz=0;
-	cli->handlectrlz=0;
-	cli->ctrlzexeccmd=1;
+static inline int yacli_filter_feedv_head(filter_inst *fltr,const struct iovec *iov,int iovcnt) { // {{{
+	int k;
 
-	cli->noopf.next=NULL;
-	cli->noopf.cli=cli;
-	cli->noopf.cmd="noop";
-	cli->noopf.help="";
-	cli->noopf.feed=yacli_filter_feed_noop;
-	cli->noopf.done=yacli_filter_done_noop;
-	cli->noopf.allownext=0;
-	cli->noopi.next=NULL;
-	cli->noopi.fltr=&cli->noopf;
-	cli->noopi.params=NULL;
-	cli->noopi.buf=NULL;
-	cli->noopi.bufsiz=0;
-	cli->noopi.buflen=0;
+	if (!fltr)
+		return -1;
+	if (!fltr->fltr)
+		return -1;
+	if (!fltr->fltr->cli)
+		return -1;
+	if (!fltr->next)
+		return -1;
+	if (fltr->full)
+		return YACLI_OUTPUT_DONE;
 
-	yacli_add_fcmd_s(cli,&cli->noopi);
+	if (!fltr->private[1]) { // first feed, parse line count
+		fltr->private[0]=mymax(yacli_filter_num(fltr->params,10),0); // params were checked before the command
+		fltr->private[1]=1;
+	}
 
-	yacli_add_filter(cli,"include","Filter output that contains the parameter text",yacli_filter_feed_include,yacli_filter_done_include,1);
-	yacli_add_filter(cli,"exclude","Filter output that contains the parameter text",yacli_filter_feed_exclude,yacli_filter_done_exclude,1);
-	yacli_add_filter(cli,"count","Display output line count",yacli_filter_feed_count,yacli_filter_done_count,0);
+	if (!fltr->private[0]) { // nothing to show at all
+		fltr->full=1;
+		return YACLI_OUTPUT_DONE;
+	}
 
-	return cli;
+	for (k=0;k<iovcnt;k++) {
+		const char *s=iov[k].iov_base;
+		size_t i;
 
-allocerror:
-	if (cli->morebuf)
-		free(cli->morebuf);
-	if (cli->buffer)
-		free(cli->buffer);
-	if (cli->banner)
-		free(cli->banner);
-	if (cli->level)
-		free(cli->level);
-	if (cli->moreprompt)
-		free(cli->moreprompt);
-	if (cli->hostname)
-		free(cli->hostname);
-	free(cli);
-	return NULL;
-} // }}}
+		for (i=0;i<iov[k].iov_len;i++)
+			if (s[i]=='\n'&&!--fltr->private[0]) { // this is the last wanted line
+				struct iovec last;
 
-static inline void yacli_free_parsed(yacli *cli) { // {{{
-	int i;
+				last.iov_base=iov[k].iov_base;
+				last.iov_len=i+1;
+				yacli_filter_feedv(fltr->next,iov,k); // whole fragments before this one
+				yacli_filter_feedv(fltr->next,&last,1);
+				fltr->full=1; // only our input is done, next filters still get done
+				return YACLI_OUTPUT_DONE;
+			}
+	}
 
-	if (!cli)
-		return;
+	k=yacli_filter_feedv(fltr->next,iov,iovcnt);
+	return yacli_filter_full(fltr)?YACLI_OUTPUT_DONE:k;
+} // }}}
 
-	if (!cli->parsedcmd) {
-		cli->parsedcnt=0;
-		cli->parsedsiz=0;
-		return;
-	}
+static inline int yacli_filter_feed_head(filter_inst *fltr,const char *line,int len) { // {{{
+	struct iovec iov;
 
-	for (i=0;i<cli->parsedcnt;i++)
-		free(cli->parsedcmd[i]);
-	free(cli->parsedcmd);
-	cli->parsedcmd=NULL;
-	cli->parsedcnt=0;
-	cli->parsedsiz=0;
+	iov.iov_base=(void *)line;
+	iov.iov_len=len;
+	return yacli_filter_feedv_head(fltr,&iov,1);
 } // }}}
 
-static inline void yacli_free_flts(yacli *cli) { // {{{
-	if (!cli)
+static inline void yacli_filter_done_head(filter_inst *fltr) { // {{{
+	if (!fltr)
+		return;
+	if (!fltr->next)
+		return;
+	if (!fltr->next->fltr)
+		return;
+	if (!fltr->next->fltr->done)
 		return;
-	while (cli->flts) {
-		filter *f=cli->flts;
 
-		cli->flts=cli->flts->next;
-		if (f->cmd)
-			free(f->cmd);
-		if (f->help)
-			free(f->help);
-		free(f);
-	}
+	fltr->next->fltr->done(fltr->next);
 } // }}}
 
-static inline void yacli_clear_parsed(yacli *cli) { // {{{
+typedef struct _lastring {
+	char **ln; // line buffers
+	int *len; // line lengths
+	int *siz; // line buffer sizes
+	int n; // ring size
+	int cnt; // complete lines in ring
+	int beg; // index of the oldest line
+	uint8_t part:1; // last line is not yet complete
+} lastring;
+
+static inline void yacli_filter_clean_last(filter_inst *fltr) { // {{{
+	lastring *r;
 	int i;
 
-	if (!cli)
+	if (!fltr)
 		return;
-
-	if (!cli->parsedcmd) {
-		cli->parsedcnt=0;
-		cli->parsedsiz=0;
+	if (!fltr->pdata)
 		return;
-	}
 
-	for (i=0;i<cli->parsedcnt;i++)
-		free(cli->parsedcmd[i]);
-	cli->parsedcnt=0;
+	r=fltr->pdata;
+	for (i=0;i<r->n;i++)
+		if (r->ln[i])
+			free(r->ln[i]);
+	free(r->ln);
+	free(r->len);
+	free(r->siz);
+	free(r);
+	fltr->pdata=NULL;
 } // }}}
 
-static inline void yacli_add_parsed(yacli *cli,const char *word) { // {{{
-	int step=BUFFER_STEP/sizeof(char *);
-	char *dw;
+static inline int yacli_filter_feed_last(filter_inst *fltr,const char *line,int len) { // {{{
+	lastring *r;
+	int i,j=0;
 
-	if (!cli)
-		return;
+	if (!fltr)
+		return -1;
+	if (!fltr->fltr)
+		return -1;
+	if (!fltr->fltr->cli)
+		return -1;
 
-	dw=strdup(word);
-	if (!dw)
-		return;
+	if (!fltr->private[1]) { // first feed, parse line count and allocate the ring
+		fltr->private[0]=mymax(yacli_filter_num(fltr->params,10),0); // params were checked before the command
+		fltr->private[1]=1;
+		if (fltr->private[0]) {
+			r=calloc(1,sizeof *r);
+			if (!r)
+				return -1;
+			r->n=fltr->private[0];
+			r->ln=calloc(r->n,sizeof *r->ln);
+			r->len=calloc(r->n,sizeof *r->len);
+			r->siz=calloc(r->n,sizeof *r->siz);
+			fltr->pdata=r;
+			if (!r->ln||!r->len||!r->siz) {
+				yacli_filter_clean_last(fltr);
+				return -1;
+			}
+		}
+	}
+
+	r=fltr->pdata;
+	if (!r) // zero lines requested or no memory
+		return len;
+
+	while (j<len) {
+		int idx;
+
+		for (i=j;i<len;i++)
+			if (line[i]=='\n')
+				break;
+		if (i<len) // include the new line
+			i++;
+
+		if (!r->part) { // start a new line, evict the oldest one if the ring is full
+			if (r->cnt==r->n) {
+				r->beg=(r->beg+1)%r->n;
+				r->cnt--;
+			}
+			r->len[(r->beg+r->cnt)%r->n]=0;
+			r->part=1;
+		}
+		idx=(r->beg+r->cnt)%r->n;
+		if (yacli_buf_inc(&r->ln[idx],&r->siz[idx],&r->len[idx],i-j)) // no memory
+			return -1;
+		memcpy(r->ln[idx]+r->len[idx],line+j,i-j);
+		r->len[idx]+=i-j;
+		if (line[i-1]=='\n') { // line is complete
+			r->cnt++;
+			r->part=0;
+		}
+		j=i;
+	}
+
+	return len;
+} // }}}
+
+static inline void yacli_filter_done_last(filter_inst *fltr) { // {{{
+	lastring *r;
+	int i;
+
+	if (!fltr)
+		return;
+	if (!fltr->next)
+		return;
+	if (!fltr->next->fltr)
+		return;
+	if (!fltr->next->fltr->feed)
+		return;
+	if (!fltr->next->fltr->done)
+		return;
+
+	r=fltr->pdata;
+	if (r) {
+		if (r->part) { // count the unfinished line too
+			r->cnt++;
+			r->part=0;
+		}
+		for (i=0;i<r->cnt&&!yacli_filter_full(fltr);i++) {
+			int idx=(r->beg+i)%r->n;
+
+			fltr->next->fltr->feed(fltr->next,r->ln[idx],r->len[idx]);
+			if (r->ln[idx][r->len[idx]-1]!='\n')
+				fltr->next->fltr->feed(fltr->next,"\n",1); // pass finishing \n
+		}
+		r->cnt=0;
+	}
+	fltr->next->fltr->done(fltr->next);
+} // }}}
+
+typedef struct _sortent {
+	const char *line; // zero terminated line
+	const char *key; // start of sort key in line
+	double num; // numeric value of key
+} sortent;
+
+typedef struct _sortrun {
+	FILE *f; // temp file with sorted lines
+	char *buf; // current line
+	size_t siz; // current line alloc size
+	sortent e; // current line parsed
+	uint8_t eof:1; // no more lines
+} sortrun;
+
+typedef struct _sortst {
+	char *arena; // zero terminated lines
+	size_t *off; // line offsets in arena
+	sortent *ent; // sort entries
+	sortrun *run; // sorted runs in temp files
+	size_t arenasiz; // arena alloc size
+	size_t arenalen; // arena data len
+	size_t part; // offset of unfinished line
+	size_t n; // complete lines
+	size_t offsiz; // off alloc size
+	int nrun; // run count
+	int col; // key column (1 based), 0 for whole line
+	uint8_t numeric:1; // compare keys as numbers
+	uint8_t reverse:1; // reverse the result
+	uint8_t error:1; // alloc or io error, pass the rest unsorted
+} sortst;
+
+static inline void yacli_sort_key(sortst *st,sortent *e,const char *line) { // {{{
+	const char *k=line;
+	int i;
+
+	for (i=1;i<st->col;i++) { // skip to key column
+		while (*k==' '||*k=='\t')
+			k++;
+		while (*k&&*k!=' '&&*k!='\t')
+			k++;
+	}
+	while (*k==' '||*k=='\t')
+		k++;
+	e->line=line;
+	e->key=k;
+	e->num=st->numeric?strtod(k,NULL):0;
+} // }}}
+
+static inline int yacli_sort_cmp(sortst *st,const sortent *a,const sortent *b) { // {{{
+	int r=0;
+
+	if (st->numeric)
+		r=(a->num>b->num)-(a->num<b->num);
+	if (!r)
+		r=strcmp(a->key,b->key);
+	if (!r&&st->col)
+		r=strcmp(a->line,b->line);
+	return st->reverse?-r:r;
+} // }}}
+
+static inline void yacli_sort_ents(sortst *st,sortent *a,sortent *t,size_t n) { // {{{
+	// bottom up merge sort; stable and does not need a global compare context
+	size_t w,i;
+
+	for (w=1;w<n;w*=2) {
+		for (i=0;i<n;i+=2*w) {
+			size_t l=i,m=mymin(i+w,n),r=m,e=mymin(i+2*w,n),k=i;
+
+			while (l<m&&r<e)
+				t[k++]=yacli_sort_cmp(st,&a[r],&a[l])<0?a[r++]:a[l++];
+			while (l<m)
+				t[k++]=a[l++];
+			while (r<e)
+				t[k++]=a[r++];
+		}
+		memcpy(a,t,n*sizeof *a);
+	}
+} // }}}
+
+static inline int yacli_sort_inmem(sortst *st) { // {{{
+	// sort lines in memory, return 0 on success
+	sortent *t;
+	size_t i;
+
+	if (st->ent)
+		free(st->ent);
+	st->ent=malloc(st->n*sizeof *st->ent+1);
+	t=malloc(st->n*sizeof *t+1);
+	if (!st->ent||!t) {
+		if (t)
+			free(t);
+		return -1;
+	}
+	for (i=0;i<st->n;i++)
+		yacli_sort_key(st,&st->ent[i],st->arena+st->off[i]);
+	yacli_sort_ents(st,st->ent,t,st->n);
+	free(t);
+	return 0;
+} // }}}
+
+static inline int yacli_sort_spill(sortst *st) { // {{{
+	// write sorted lines to a temp file and reuse the memory
+	sortrun *nr;
+	size_t i;
+	FILE *f;
+
+	if (yacli_sort_inmem(st))
+		return -1;
+	f=tmpfile();
+	if (!f)
+		return -1;
+	nr=realloc(st->run,(st->nrun+1)*sizeof *nr);
+	if (!nr) {
+		fclose(f);
+		return -1;
+	}
+	st->run=nr;
+	memset(&st->run[st->nrun],0,sizeof *st->run);
+	st->run[st->nrun++].f=f;
+
+	for (i=0;i<st->n;i++)
+		if (fputs(st->ent[i].line,f)==EOF||fputc('\n',f)==EOF)
+			break;
+	if (i<st->n||fflush(f)||fseek(f,0,SEEK_SET)) { // drop the broken run, its lines are still in memory
+		fclose(f);
+		st->nrun--;
+		return -1;
+	}
+
+	if (st->arenalen>st->part) // keep unfinished line
+		memmove(st->arena,st->arena+st->part,st->arenalen-st->part);
+	st->arenalen-=st->part;
+	st->part=0;
+	st->n=0;
+	free(st->ent);
+	st->ent=NULL;
+	return 0;
+} // }}}
+
+static inline void yacli_filter_clean_sort(filter_inst *fltr) { // {{{
+	sortst *st;
+	int i;
+
+	if (!fltr)
+		return;
+	if (!fltr->pdata)
+		return;
+
+	st=fltr->pdata;
+	for (i=0;i<st->nrun;i++) {
+		if (st->run[i].f)
+			fclose(st->run[i].f);
+		if (st->run[i].buf)
+			free(st->run[i].buf);
+	}
+	if (st->run)
+		free(st->run);
+	if (st->arena)
+		free(st->arena);
+	if (st->off)
+		free(st->off);
+	if (st->ent)
+		free(st->ent);
+	free(st);
+	fltr->pdata=NULL;
+} // }}}
+
+static inline int yacli_sort_parse(sortst *st,const char *params) { // {{{
+	// parse -n -r -k N (also joined, like -nrk2); return -1 on anything else
+	const char *p;
+
+	for (p=params?params:"";*p;) {
+		while (*p==' ')
+			p++;
+		if (!*p)
+			break;
+		if (*p!='-'||!p[1]||p[1]==' ')
+			return -1;
+		for (p++;*p&&*p!=' ';p++) {
+			if (*p=='n')
+				st->numeric=1;
+			else if (*p=='r')
+				st->reverse=1;
+			else if (*p=='k') {
+				char *e;
+				long n;
+
+				p++;
+				while (*p==' ')
+					p++;
+				n=strtol(p,&e,10);
+				if (e==p||(*e&&*e!=' ')||n<1||n>INT_MAX) // key column is counted from 1
+					return -1;
+				st->col=n;
+				p=e;
+				break;
+			} else
+				return -1;
+		}
+	}
+	return 0;
+} // }}}
+
+static inline int yacli_filter_check_sort(const char *params) { // {{{
+	sortst st;
+
+	memset(&st,0,sizeof st);
+	return yacli_sort_parse(&st,params);
+} // }}}
+
+static inline sortst *yacli_sort_init(filter_inst *fltr) { // {{{
+	sortst *st;
+
+	st=calloc(1,sizeof *st);
+	if (!st)
+		return NULL;
+	fltr->pdata=st;
+
+	yacli_sort_parse(st,fltr->params); // params were checked before the command
+	return st;
+} // }}}
+
+static inline int yacli_sort_next(sortst *st,sortrun *r) { // {{{
+	// read next line of a run, return 0 on success
+	ssize_t l=getline(&r->buf,&r->siz,r->f);
+
+	if (l<=0) {
+		r->eof=1;
+		return -1;
+	}
+	if (r->buf[l-1]=='\n')
+		r->buf[l-1]=0;
+	yacli_sort_key(st,&r->e,r->buf);
+	return 0;
+} // }}}
+
+static inline void yacli_sort_merge(filter_inst *fltr,sortst *st) { // {{{
+	// k-way merge of sorted runs
+	struct iovec iov[2];
+	int j;
+
+	for (j=0;j<st->nrun;j++)
+		yacli_sort_next(st,&st->run[j]);
+	while (!yacli_filter_full(fltr)) {
+		sortrun *m=NULL;
+
+		for (j=0;j<st->nrun;j++) // find smallest head
+			if (!st->run[j].eof&&(!m||yacli_sort_cmp(st,&st->run[j].e,&m->e)<0))
+				m=&st->run[j];
+		if (!m)
+			break;
+		iov[0].iov_base=m->buf;
+		iov[0].iov_len=strlen(m->buf);
+		iov[1].iov_base="\n";
+		iov[1].iov_len=1;
+		yacli_filter_feedv(fltr->next,iov,2);
+		yacli_sort_next(st,m);
+	}
+} // }}}
+
+static inline void yacli_sort_fail(filter_inst *fltr,sortst *st) { // {{{
+	// cannot sort: tell so, pass what was collected and let the rest through as is
+	const char *msg="Sort failed (out of memory or temp space), output is not sorted\n";
+	struct iovec iov[2];
+	size_t i,l;
+
+	st->error=1;
+	fltr->next->fltr->feed(fltr->next,msg,strlen(msg));
+	yacli_sort_merge(fltr,st); // spilled runs are sorted
+	for (i=0;i<st->part&&!yacli_filter_full(fltr);i+=l+1) { // complete lines in memory, in order of arrival
+		l=strlen(st->arena+i);
+		iov[0].iov_base=st->arena+i;
+		iov[0].iov_len=l;
+		iov[1].iov_base="\n";
+		iov[1].iov_len=1;
+		yacli_filter_feedv(fltr->next,iov,2);
+	}
+	if (st->part<st->arenalen&&!yacli_filter_full(fltr)) // unfinished line, its end comes unsorted
+		fltr->next->fltr->feed(fltr->next,st->arena+st->part,st->arenalen-st->part);
+	st->arenalen=0;
+	st->part=0;
+	st->n=0;
+} // }}}
+
+static inline int yacli_filter_feed_sort(filter_inst *fltr,const char *line,int len) { // {{{
+	sortst *st;
+	int i;
+
+	if (!fltr)
+		return -1;
+	if (!fltr->fltr)
+		return -1;
+	if (!fltr->fltr->cli)
+		return -1;
+	if (!fltr->next)
+		return -1;
+	if (!fltr->next->fltr)
+		return -1;
+	if (!fltr->next->fltr->feed)
+		return -1;
+
+	st=fltr->pdata;
+	if (!st&&!(st=yacli_sort_init(fltr)))
+		return -1;
+	if (st->error) // cannot sort, at least show the output
+		return fltr->next->fltr->feed(fltr->next,line,len);
+
+	for (i=0;i<len;i++) {
+		if (st->arenalen+1>=st->arenasiz) {
+			size_t ns=st->arenasiz?st->arenasiz*2:BUFFER_STEP*16;
+			char *na=realloc(st->arena,ns);
+
+			if (!na) {
+				yacli_sort_fail(fltr,st);
+				return fltr->next->fltr->feed(fltr->next,line+i,len-i);
+			}
+			st->arena=na;
+			st->arenasiz=ns;
+		}
+		if (line[i]!='\n') {
+			st->arena[st->arenalen++]=line[i];
+			continue;
+		}
+		if (st->n>=st->offsiz) {
+			size_t ns=st->offsiz?st->offsiz*2:BUFFER_STEP;
+			size_t *no=realloc(st->off,ns*sizeof *no);
+
+			if (!no) {
+				yacli_sort_fail(fltr,st);
+				return fltr->next->fltr->feed(fltr->next,line+i,len-i);
+			}
+			st->off=no;
+			st->offsiz=ns;
+		}
+		st->arena[st->arenalen++]=0;
+		st->off[st->n++]=st->part;
+		st->part=st->arenalen;
+
+		// arena, offsets and the entries needed for sorting have to fit the budget
+		if (st->arenalen+st->n*(sizeof *st->off+2*sizeof *st->ent)>fltr->fltr->cli->sortmem)
+			if (yacli_sort_spill(st)) {
+				yacli_sort_fail(fltr,st);
+				if (i+1<len)
+					return fltr->next->fltr->feed(fltr->next,line+i+1,len-i-1);
+				return len;
+			}
+	}
+
+	return len;
+} // }}}
+
+static inline void yacli_filter_done_sort(filter_inst *fltr) { // {{{
+	struct iovec iov[2*TABLE_WINDOW];
+	sortst *st;
+	size_t i;
+	int k;
+
+	if (!fltr)
+		return;
+	if (!fltr->fltr)
+		return;
+	if (!fltr->next)
+		return;
+	if (!fltr->next->fltr)
+		return;
+	if (!fltr->next->fltr->done)
+		return;
+
+	st=fltr->pdata;
+	if (st&&!st->error&&st->part<st->arenalen) // terminate unfinished line
+		yacli_filter_feed_sort(fltr,"\n",1);
+
+	if (st&&!st->error&&st->nrun&&st->n&&yacli_sort_spill(st)) // merge needs all lines in runs
+		yacli_sort_fail(fltr,st);
+
+	if (st&&!st->error&&!st->nrun) { // all fits in memory
+		if (yacli_sort_inmem(st))
+			yacli_sort_fail(fltr,st);
+		for (i=0,k=0;!st->error&&i<st->n&&!yacli_filter_full(fltr);i++) {
+			iov[k].iov_base=(void *)st->ent[i].line;
+			iov[k++].iov_len=strlen(st->ent[i].line);
+			iov[k].iov_base="\n";
+			iov[k++].iov_len=1;
+			if (k==sizeof iov/sizeof *iov||i+1==st->n) { // pass a batch of lines
+				yacli_filter_feedv(fltr->next,iov,k);
+				k=0;
+			}
+		}
+	} else if (st&&!st->error)
+		yacli_sort_merge(fltr,st);
+	fltr->next->fltr->done(fltr->next);
+} // }}}
+
+typedef struct _aggent {
+	size_t off; // key offset in arena
+	size_t idx; // order of appearance
+	unsigned long cnt; // line count for key
+	unsigned hash; // key hash
+	int len; // key len
+} aggent;
+
+typedef struct _aggst {
+	char *arena; // distinct keys
+	aggent *ent; // distinct keys in order of appearance
+	size_t *slot; // open addressing hash of ent index+1, 0 is empty
+	size_t arenasiz; // arena alloc size
+	size_t arenalen; // arena data len
+	size_t n; // distinct key count
+	size_t entsiz; // ent alloc size
+	size_t nslot; // slot count, power of 2
+	int col; // key column (1 based), 0 for whole line
+	uint8_t counts:1; // prefix lines with counts
+	uint8_t bycount:1; // order by count, most frequent first
+} aggst;
+
+static inline unsigned yacli_agg_hash(const char *s,int len) { // {{{
+	unsigned h=2166136261u; // FNV-1a
+	int i;
+
+	for (i=0;i<len;i++) {
+		h^=(unsigned char)s[i];
+		h*=16777619u;
+	}
+	return h;
+} // }}}
+
+static inline void yacli_filter_clean_agg(filter_inst *fltr) { // {{{
+	aggst *st;
+
+	if (!fltr)
+		return;
+	if (!fltr->pdata)
+		return;
+
+	st=fltr->pdata;
+	if (st->arena)
+		free(st->arena);
+	if (st->ent)
+		free(st->ent);
+	if (st->slot)
+		free(st->slot);
+	free(st);
+	fltr->pdata=NULL;
+} // }}}
+
+static inline aggst *yacli_agg_init(filter_inst *fltr) { // {{{
+	int isuniq=!strcmp(fltr->fltr->cmd,"uniq");
+	const char *p;
+	aggst *st;
+
+	st=calloc(1,sizeof *st);
+	if (!st)
+		return NULL;
+
+	st->nslot=BUFFER_STEP;
+	st->slot=calloc(st->nslot,sizeof *st->slot);
+	if (!st->slot) {
+		free(st);
+		return NULL;
+	}
+	fltr->pdata=st;
+
+	st->counts=!isuniq; // count-by always shows counts
+	for (p=fltr->params?fltr->params:"";*p;) { // parse -c -s and column number
+		while (*p==' ')
+			p++;
+		if (*p=='-') {
+			for (p++;*p&&*p!=' ';p++) {
+				if (*p=='c')
+					st->counts=1;
+				else if (*p=='s')
+					st->bycount=1;
+			}
+			continue;
+		}
+		if (!isuniq&&isdigit((unsigned char)*p)) // count-by column, 0 or none is the whole line
+			st->col=atoi(p);
+		while (*p&&*p!=' ')
+			p++;
+	}
+	return st;
+} // }}}
+
+static inline int yacli_agg_grow(aggst *st) { // {{{
+	// double the hash and reinsert all keys
+	size_t ns=st->nslot*2;
+	size_t *nt=calloc(ns,sizeof *nt);
+	size_t i;
+
+	if (!nt)
+		return -1;
+	for (i=0;i<st->n;i++) {
+		size_t h=st->ent[i].hash&(ns-1);
+
+		while (nt[h])
+			h=(h+1)&(ns-1);
+		nt[h]=i+1;
+	}
+	free(st->slot);
+	st->slot=nt;
+	st->nslot=ns;
+	return 0;
+} // }}}
+
+static inline int yacli_agg_add(aggst *st,const char *key,int len) { // {{{
+	// count one more line for key, return 0 on success
+	unsigned hash=yacli_agg_hash(key,len);
+	size_t h=hash&(st->nslot-1);
+	aggent *e;
+
+	while (st->slot[h]) {
+		e=&st->ent[st->slot[h]-1];
+		if (e->hash==hash&&e->len==len&&!memcmp(st->arena+e->off,key,len)) {
+			e->cnt++;
+			return 0;
+		}
+		h=(h+1)&(st->nslot-1);
+	}
+
+	if (st->n>=st->entsiz) {
+		size_t ns=st->entsiz?st->entsiz*2:BUFFER_STEP;
+		aggent *ne=realloc(st->ent,ns*sizeof *ne);
+
+		if (!ne)
+			return -1;
+		st->ent=ne;
+		st->entsiz=ns;
+	}
+	if (st->arenalen+len>=st->arenasiz) {
+		size_t ns=mymax(st->arenasiz*2,st->arenalen+len+BUFFER_STEP);
+		char *na=realloc(st->arena,ns);
+
+		if (!na)
+			return -1;
+		st->arena=na;
+		st->arenasiz=ns;
+	}
+	memcpy(st->arena+st->arenalen,key,len);
+	e=&st->ent[st->n];
+	e->off=st->arenalen;
+	e->len=len;
+	e->cnt=1;
+	e->hash=hash;
+	e->idx=st->n;
+	st->arenalen+=len;
+	st->slot[h]=++st->n;
+
+	if (st->n*4>=st->nslot*3) // keep load factor under 75%
+		return yacli_agg_grow(st);
+	return 0;
+} // }}}
+
+static inline int yacli_agg_line(aggst *st,const char *line,int len) { // {{{
+	int i,j;
+
+	if (!st->col)
+		return yacli_agg_add(st,line,len);
+
+	for (i=0,j=1;;j++) { // find key column
+		while (i<len&&(line[i]==' '||line[i]=='\t'))
+			i++;
+		if (i>=len) // line does not have this column
+			return 0;
+		if (j==st->col)
+			break;
+		while (i<len&&line[i]!=' '&&line[i]!='\t')
+			i++;
+	}
+	for (j=i;j<len&&line[j]!=' '&&line[j]!='\t';j++)
+		;
+	return yacli_agg_add(st,line+i,j-i);
+} // }}}
+
+static inline int yacli_filter_feed_agg(filter_inst *fltr,const char *line,int len) { // {{{
+	aggst *st;
+	int i,j=0;
+
+	if (!fltr)
+		return -1;
+	if (!fltr->fltr)
+		return -1;
+
+	st=fltr->pdata;
+	if (!st&&!(st=yacli_agg_init(fltr)))
+		return -1;
+
+	for (i=0;i<len;i++) {
+		if (line[i]!='\n')
+			continue;
+		if (fltr->buflen) { // complete the line collected from previous feeds
+			if (yacli_buf_inc(&fltr->buf,&fltr->bufsiz,&fltr->buflen,i-j))
+				return -1;
+			memcpy(fltr->buf+fltr->buflen,line+j,i-j);
+			fltr->buflen+=i-j;
+			if (yacli_agg_line(st,fltr->buf,fltr->buflen))
+				return -1;
+			fltr->buflen=0;
+		} else if (yacli_agg_line(st,line+j,i-j))
+			return -1;
+		j=i+1;
+	}
+	if (j<len) { // keep the unfinished line
+		if (yacli_buf_inc(&fltr->buf,&fltr->bufsiz,&fltr->buflen,len-j))
+			return -1;
+		memcpy(fltr->buf+fltr->buflen,line+j,len-j);
+		fltr->buflen+=len-j;
+	}
+
+	return len;
+} // }}}
+
+static int yacli_agg_cmp(const void *a,const void *b) { // {{{
+	const aggent *ea=*(const aggent **)a;
+	const aggent *eb=*(const aggent **)b;
+
+	if (ea->cnt!=eb->cnt) // most frequent first
+		return ea->cnt<eb->cnt?1:-1;
+	return ea->idx<eb->idx?-1:ea->idx>eb->idx; // then in order of appearance
+} // }}}
+
+static inline void yacli_filter_done_agg(filter_inst *fltr) { // {{{
+	aggent **ord=NULL;
+	aggst *st;
+	size_t i;
+
+	if (!fltr)
+		return;
+	if (!fltr->fltr)
+		return;
+	if (!fltr->next)
+		return;
+	if (!fltr->next->fltr)
+		return;
+	if (!fltr->next->fltr->done)
+		return;
+
+	st=fltr->pdata;
+	if (st&&fltr->buflen) { // count unfinished line
+		yacli_agg_line(st,fltr->buf,fltr->buflen);
+		fltr->buflen=0;
+	}
+	if (st&&st->bycount) {
+		ord=malloc(st->n*sizeof *ord+1);
+		if (ord) {
+			for (i=0;i<st->n;i++)
+				ord[i]=&st->ent[i];
+			qsort(ord,st->n,sizeof *ord,yacli_agg_cmp);
+		}
+	}
+	for (i=0;st&&i<st->n&&!yacli_filter_full(fltr);i++) {
+		aggent *e=ord?ord[i]:&st->ent[i];
+		struct iovec iov[3];
+		char cnt[32];
+
+		iov[0].iov_base=cnt;
+		iov[0].iov_len=st->counts?snprintf(cnt,sizeof cnt,"%7lu ",e->cnt):0;
+		iov[1].iov_base=st->arena+e->off;
+		iov[1].iov_len=e->len;
+		iov[2].iov_base="\n";
+		iov[2].iov_len=1;
+		yacli_filter_feedv(fltr->next,iov,3);
+	}
+	if (ord)
+		free(ord);
+	fltr->next->fltr->done(fltr->next);
+} // }}}
+
+typedef struct _recst {
+	char *out; // rendered records, passed on once per feed or row
+	int outsiz; // out alloc size
+	int outlen; // out data len
+	uint8_t json:1; // json lines, otherwise csv
+	uint8_t text:1; // csv: last record was a text line
+	uint8_t hdr:1; // csv: header for current record kind is printed
+} recst;
+
+static inline void yacli_filter_clean_rec(filter_inst *fltr) { // {{{
+	recst *st;
+
+	if (!fltr)
+		return;
+	if (!fltr->pdata)
+		return;
+
+	st=fltr->pdata;
+	if (st->out)
+		free(st->out);
+	free(st);
+	fltr->pdata=NULL;
+} // }}}
+
+static inline recst *yacli_rec_init(filter_inst *fltr) { // {{{
+	recst *st;
+
+	st=calloc(1,sizeof *st);
+	if (!st)
+		return NULL;
+	st->json=!strcmp(fltr->fltr->cmd,"json");
+	fltr->pdata=st;
+	return st;
+} // }}}
+
+static inline int yacli_rec_str(recst *st,const char *s,int len,int num) { // {{{
+	// append value quoted and escaped for the output format
+	static const char hex[]="0123456789abcdef";
+	int i,quote=1;
+
+	if (st->json&&num)
+		quote=0;
+	if (!st->json) { // csv quotes only when needed
+		quote=len&&(s[0]==' '||s[len-1]==' ');
+		for (i=0;i<len&&!quote;i++)
+			if (s[i]==','||s[i]=='"'||s[i]=='\n'||s[i]=='\r')
+				quote=1;
+	}
+
+	// worst case json escape is 6 bytes per byte
+	if (yacli_buf_inc(&st->out,&st->outsiz,&st->outlen,len*6+2))
+		return -1;
+	if (quote)
+		st->out[st->outlen++]='"';
+	for (i=0;i<len;i++) {
+		unsigned char c=s[i];
+
+		if (!quote)
+			st->out[st->outlen++]=c;
+		else if (!st->json) {
+			if (c=='"')
+				st->out[st->outlen++]='"';
+			st->out[st->outlen++]=c;
+		} else if (c=='"'||c=='\\') {
+			st->out[st->outlen++]='\\';
+			st->out[st->outlen++]=c;
+		} else if (c=='\n') {
+			st->out[st->outlen++]='\\';
+			st->out[st->outlen++]='n';
+		} else if (c=='\t') {
+			st->out[st->outlen++]='\\';
+			st->out[st->outlen++]='t';
+		} else if (c<0x20||c==0x7f) {
+			memcpy(st->out+st->outlen,"\\u00",4);
+			st->outlen+=4;
+			st->out[st->outlen++]=hex[c>>4];
+			st->out[st->outlen++]=hex[c&15];
+		} else
+			st->out[st->outlen++]=c;
+	}
+	if (quote)
+		st->out[st->outlen++]='"';
+	return 0;
+} // }}}
+
+static inline int yacli_rec_raw(recst *st,const char *s) { // {{{
+	int len=strlen(s);
+
+	if (yacli_buf_inc(&st->out,&st->outsiz,&st->outlen,len))
+		return -1;
+	memcpy(st->out+st->outlen,s,len);
+	st->outlen+=len;
+	return 0;
+} // }}}
+
+static inline int yacli_rec_line(recst *st,const char *s,int len) { // {{{
+	// plain text line becomes a record with single field
+	if (len&&s[len-1]=='\r')
+		len--;
+	if (!st->json&&(!st->hdr||!st->text)) {
+		if (yacli_rec_raw(st,"line\n"))
+			return -1;
+		st->hdr=1;
+		st->text=1;
+	}
+	if (st->json&&yacli_rec_raw(st,"{\"line\":"))
+		return -1;
+	if (yacli_rec_str(st,s,len,0))
+		return -1;
+	return yacli_rec_raw(st,st->json?"}\n":"\n");
+} // }}}
+
+static inline int yacli_rec_flush(filter_inst *fltr,recst *st) { // {{{
+	int ret=0;
+
+	if (st->outlen)
+		ret=fltr->next->fltr->feed(fltr->next,st->out,st->outlen);
+	st->outlen=0;
+	return yacli_filter_full(fltr)?YACLI_OUTPUT_DONE:ret;
+} // }}}
+
+static inline int yacli_filter_feed_rec(filter_inst *fltr,const char *line,int len) { // {{{
+	recst *st;
+	int i,j=0;
+
+	if (!fltr)
+		return -1;
+	if (!fltr->fltr)
+		return -1;
+	if (!fltr->next)
+		return -1;
+	if (!fltr->next->fltr)
+		return -1;
+	if (!fltr->next->fltr->feed)
+		return -1;
+
+	st=fltr->pdata;
+	if (!st&&!(st=yacli_rec_init(fltr)))
+		return -1;
+
+	for (i=0;i<len;i++) {
+		if (line[i]!='\n')
+			continue;
+		if (fltr->buflen) { // complete the line collected from previous feeds
+			if (yacli_buf_inc(&fltr->buf,&fltr->bufsiz,&fltr->buflen,i-j))
+				return -1;
+			memcpy(fltr->buf+fltr->buflen,line+j,i-j);
+			fltr->buflen+=i-j;
+			if (yacli_rec_line(st,fltr->buf,fltr->buflen))
+				return -1;
+			fltr->buflen=0;
+		} else if (yacli_rec_line(st,line+j,i-j))
+			return -1;
+		j=i+1;
+	}
+	if (j<len) { // keep the unfinished line
+		if (yacli_buf_inc(&fltr->buf,&fltr->bufsiz,&fltr->buflen,len-j))
+			return -1;
+		memcpy(fltr->buf+fltr->buflen,line+j,len-j);
+		fltr->buflen+=len-j;
+	}
+
+	if ((i=yacli_rec_flush(fltr,st))<0)
+		return i;
+	return len;
+} // }}}
+
+static inline int yacli_filter_row_rec(filter_inst *fltr,table *t,int r) { // {{{
+	const int *cell;
+	const uint8_t *num;
+	recst *st;
+	int i;
+
+	if (!fltr)
+		return -1;
+	if (!fltr->fltr)
+		return -1;
+	if (!fltr->next)
+		return -1;
+	if (!fltr->next->fltr)
+		return -1;
+	if (!fltr->next->fltr->feed)
+		return -1;
+
+	st=fltr->pdata;
+	if (!st&&!(st=yacli_rec_init(fltr)))
+		return -1;
+
+	if (fltr->buflen) { // text printed before the row without new line
+		if (yacli_rec_line(st,fltr->buf,fltr->buflen))
+			return -1;
+		fltr->buflen=0;
+	}
+
+	if (!st->json&&(!st->hdr||st->text||!t->header)) { // header once per table
+		for (i=0;i<t->ncol;i++) {
+			if (i&&yacli_rec_raw(st,","))
+				return -1;
+			if (yacli_rec_str(st,t->name[i],strlen(t->name[i]),0))
+				return -1;
+		}
+		if (yacli_rec_raw(st,"\n"))
+			return -1;
+		st->hdr=1;
+		st->text=0;
+	}
+	t->header=1;
+
+	cell=t->cell+r*t->ncol;
+	num=t->num+r*t->ncol;
+	if (st->json&&yacli_rec_raw(st,"{"))
+		return -1;
+	for (i=0;i<t->ncol;i++) {
+		const char *c=t->arena+cell[i];
+
+		if (i&&yacli_rec_raw(st,","))
+			return -1;
+		if (st->json) {
+			if (yacli_rec_str(st,t->name[i],strlen(t->name[i]),0))
+				return -1;
+			if (yacli_rec_raw(st,":"))
+				return -1;
+		}
+		if (yacli_rec_str(st,c,strlen(c),num[i]))
+			return -1;
+	}
+	if (yacli_rec_raw(st,st->json?"}\n":"\n"))
+		return -1;
+
+	return yacli_rec_flush(fltr,st);
+} // }}}
+
+static inline void yacli_filter_done_rec(filter_inst *fltr) { // {{{
+	recst *st;
+
+	if (!fltr)
+		return;
+	if (!fltr->fltr)
+		return;
+	if (!fltr->next)
+		return;
+	if (!fltr->next->fltr)
+		return;
+	if (!fltr->next->fltr->done)
+		return;
+
+	st=fltr->pdata;
+	if (st&&fltr->buflen) { // unfinished line
+		yacli_rec_line(st,fltr->buf,fltr->buflen);
+		fltr->buflen=0;
+		yacli_rec_flush(fltr,st);
+	}
+	fltr->next->fltr->done(fltr->next);
+} // }}}
+
+static inline int yacli_gen_prompt(yacli *cli) { // {{{
+	// render prompt prefix "hostname(mode1-mode2)level" and layout metrics
+	int hl=strlen(cli->hostname);
+	int ll=strlen(cli->level);
+
+	if (hl+cli->modeslen+ll+1>cli->pfxsiz) {
+		char *t=realloc(cli->pfx,hl+cli->modeslen+ll+1);
+
+		if (!t)
+			return -1;
+		cli->pfx=t;
+		cli->pfxsiz=hl+cli->modeslen+ll+1;
+	}
+	memcpy(cli->pfx,cli->hostname,hl);
+	if (cli->modeslen)
+		memcpy(cli->pfx+hl,cli->modes,cli->modeslen);
+	memcpy(cli->pfx+hl+cli->modeslen,cli->level,ll+1);
+	cli->pfxlen=hl+cli->modeslen+ll;
+	cli->dspace=cli->sx-(cli->pfxlen+1)-1; // last char cannot be used
+	cli->redraw=1;
+	return 0;
+} // }}}
+
+inline yacli *yacli_init(yascreen *s) { // {{{
+	yacli *cli=calloc(1,sizeof *cli);
+	filter *f;
+
+	if (!cli)
+		return NULL;
+
+	if (!s) {
+		free(cli);
+		return NULL;
+	}
+
+	cli->s=s;
+	// we use explicit flush, tell yascreen not to do it
+	yascreen_line_flush(cli->s,0);
+
+	if (myver[0]==0) { // reformat the static version string
+		char *rev=strstr(myver+1,"$Revision: ");
+		int vermaj,vermin;
+
+		if (rev) {
+			sscanf(rev+strlen("$Revision: "),"%d.%d",&vermaj,&vermin);
+			vermaj+=vermin/100;
+			vermin=vermin%100;
+			memmove(myver,myver+1,strlen(myver+1)+1);
+			snprintf(rev-1,sizeof myver-(rev-1-myver),"%d.%02d\n\n",vermaj,vermin);
+		}
+	}
+
+	cli->hostname=strdup("none");
+	if (!cli->hostname)
+		goto allocerror;
+	cli->cstack=NULL;
+	cli->modes=NULL;
+	cli->moreprompt=strdup("<<< more >>> [ enter=line | space=page | c=continue | q=quit ] <<< more >>>");
+	if (!cli->moreprompt)
+		goto allocerror;
+	cli->level=strdup("#");
+	if (!cli->level)
+		goto allocerror;
+	cli->banner=strdup(myver);
+	if (!cli->banner)
+		goto allocerror;
+	cli->sx=80;
+	cli->sy=25;
+	if (yacli_gen_prompt(cli))
+		goto allocerror;
+	cli->buffer=malloc(BUFFER_STEP);
+	if (!cli->buffer)
+		goto allocerror;
+	cli->bufsiz=BUFFER_STEP;
+	cli->fmtbuf=malloc(BUFFER_STEP);
+	if (!cli->fmtbuf)
+		goto allocerror;
+	cli->fmtsiz=BUFFER_STEP;
+	cli->buflen=0;
+	cli->bufpos=0;
+	cli->cursor=0;
+	cli->state=IN_NORM;
+	cli->redraw=1;
+	cli->retcode=YACLI_LOOP;
+	cli->istelnet=0;
+	cli->showtsize=0;
+	cli->rcmd=NULL;
+	cli->rpos=0;
+	cli->wastab=0;
+	cli->lines=0;
+	cli->morebuf=strdup("");
+	if (!cli->morebuf)
+		goto allocerror;
+	cli->morelen=0;
+	cli->moresiz=0;
+	cli->more=1; // use paged output by default
+	cli->clearmorel=1; // remove more prompt when showing next line
+	cli->clearmoreq=0; // leave more prompt when quit is pressed
+	cli->clearmorec=1; // remove more prompt when continue to end of output
+	cli->clearmorep=0; // leave more prompt only after whole page for clarity
+	cli->parsedcmd=NULL;
+	cli->parsedcnt=0;
+	cli->parsedsiz=0;
+	cli->handlectrlz=0;
+	cli->ctrlzexeccmd=1;
+	cli->sortmem=SORT_MEM;
+	cli->hstcap=HIST_SIZE;
+	cli->hst_p=-1;
+	cli->hsthead=-1;
+	cli->hsttail=-1;
+	cli->hstfree=-1;
+	cli->hfd=-1;
+	cli->msgfd=-1;
+	cli->outfd=-1;
+
+	cli->noopf.next=NULL;
+	cli->noopf.cli=cli;
+	cli->noopf.cmd="noop";
+	cli->noopf.help="";
+	cli->noopf.feed=yacli_filter_feed_noop;
+	cli->noopf.feedv=yacli_filter_feedv_noop;
+	cli->noopf.done=yacli_filter_done_noop;
+	cli->noopf.allownext=0;
+	cli->noopi.next=NULL;
+	cli->noopi.fltr=&cli->noopf;
+	cli->noopi.params=NULL;
+	cli->noopi.buf=NULL;
+	cli->noopi.bufsiz=0;
+	cli->noopi.buflen=0;
+
+	yacli_add_fcmd_s(cli,&cli->noopi);
+
+	yacli_add_filter(cli,"include","Filter output that contains the parameter text",yacli_filter_feed_include,NULL,yacli_filter_done_include,NULL,1);
+	yacli_add_filter(cli,"exclude","Filter output that contains the parameter text",yacli_filter_feed_exclude,NULL,yacli_filter_done_exclude,NULL,1);
+	yacli_add_filter(cli,"count","Display output line count",yacli_filter_feed_count,yacli_filter_feedv_count,yacli_filter_done_count,NULL,0);
+	f=yacli_add_filter(cli,"head","Display first N lines of output (default 10)",yacli_filter_feed_head,yacli_filter_feedv_head,yacli_filter_done_head,NULL,1);
+	if (f)
+		f->check=yacli_filter_check_num;
+	f=yacli_add_filter(cli,"last","Display last N lines of output (default 10)",yacli_filter_feed_last,NULL,yacli_filter_done_last,yacli_filter_clean_last,1);
+	if (f)
+		f->check=yacli_filter_check_num;
+	f=yacli_add_filter(cli,"sort","Sort output lines [-n numeric] [-r reverse] [-k column]",yacli_filter_feed_sort,NULL,yacli_filter_done_sort,yacli_filter_clean_sort,1);
+	if (f)
+		f->check=yacli_filter_check_sort;
+	yacli_add_filter(cli,"uniq","Display unique lines [-c with counts] [-s by count]",yacli_filter_feed_agg,NULL,yacli_filter_done_agg,yacli_filter_clean_agg,1);
+	yacli_add_filter(cli,"count-by","Count lines per value of column N [-s by count]",yacli_filter_feed_agg,NULL,yacli_filter_done_agg,yacli_filter_clean_agg,1);
+	f=yacli_add_filter(cli,"json","Display output as JSON records, one per line",yacli_filter_feed_rec,NULL,yacli_filter_done_rec,yacli_filter_clean_rec,1);
+	if (f)
+		f->row=yacli_filter_row_rec;
+	f=yacli_add_filter(cli,"csv","Display output as CSV records",yacli_filter_feed_rec,NULL,yacli_filter_done_rec,yacli_filter_clean_rec,1);
+	if (f)
+		f->row=yacli_filter_row_rec;
+
+	return cli;
+
+allocerror:
+	if (cli->morebuf)
+		free(cli->morebuf);
+	if (cli->fmtbuf)
+		free(cli->fmtbuf);
+	if (cli->buffer)
+		free(cli->buffer);
+	if (cli->banner)
+		free(cli->banner);
+	if (cli->level)
+		free(cli->level);
+	if (cli->moreprompt)
+		free(cli->moreprompt);
+	if (cli->hostname)
+		free(cli->hostname);
+	if (cli->modes)
+		free(cli->modes);
+	if (cli->pfx)
+		free(cli->pfx);
+	free(cli);
+	return NULL;
+} // }}}
+
+static inline void yacli_free_parsed(yacli *cli) { // {{{
+	int i;
+
+	if (!cli)
+		return;
+
+	if (!cli->parsedcmd) {
+		cli->parsedcnt=0;
+		cli->parsedsiz=0;
+		return;
+	}
+
+	for (i=0;i<cli->parsedcnt;i++)
+		free(cli->parsedcmd[i]);
+	free(cli->parsedcmd);
+	cli->parsedcmd=NULL;
+	cli->parsedcnt=0;
+	cli->parsedsiz=0;
+} // }}}
+
+static inline void yacli_free_flts(yacli *cli) { // {{{
+	if (!cli)
+		return;
+	while (cli->flts) {
+		filter *f=cli->flts;
+
+		cli->flts=cli->flts->next;
+		if (f->cmd)
+			free(f->cmd);
+		if (f->help)
+			free(f->help);
+		free(f);
+	}
+} // }}}
+
+static inline void yacli_clear_parsed(yacli *cli) { // {{{
+	int i;
+
+	if (!cli)
+		return;
+
+	if (!cli->parsedcmd) {
+		cli->parsedcnt=0;
+		cli->parsedsiz=0;
+		return;
+	}
+
+	for (i=0;i<cli->parsedcnt;i++)
+		free(cli->parsedcmd[i]);
+	cli->parsedcnt=0;
+} // }}}
+
+static inline void yacli_add_parsed(yacli *cli,const char *word) { // {{{
+	int step=BUFFER_STEP/sizeof(char *);
+	char *dw;
+
+	if (!cli)
+		return;
+
+	dw=strdup(word);
+	if (!dw)
+		return;
+
+	if (!cli->parsedcmd) {
+		cli->parsedcmd=calloc(sizeof(char *),step);
+		if (!cli->parsedcmd) { // memory alloc error
+			free(dw);
+			return;
+		}
+		cli->parsedcnt=0;
+		cli->parsedsiz=step;
+	}
+	if (cli->parsedcnt>=cli->parsedsiz) {
+		int cnt=cli->parsedcnt+2; // one for terminating NULL, one for the new item
+		char **nc=calloc(sizeof(char *),step*(cnt/step+1));
+
+		if (!nc) { // memory alloc error
+			free(dw);
+			return;
+		}
+		memcpy(nc,cli->parsedcmd,(cli->parsedcnt+1)*sizeof(char *));
+		free(cli->parsedcmd);
+		cli->parsedcmd=nc;
+		cli->parsedsiz=step*(cnt/step+1);
+	}
+
+	cli->parsedcmd[cli->parsedcnt++]=dw;
+	cli->parsedcmd[cli->parsedcnt]=NULL;
+} // }}}
+
+inline void yacli_set_async_output(yacli *cli,int on) { // {{{
+	if (!cli)
+		return;
+	cli->asyncout=!!on;
+} // }}}
+
+inline int yacli_set_output_format(yacli *cli,const char *fmt) { // {{{
+	filter *f;
+
+	if (!cli)
+		return -1;
+
+	if (!fmt||!*fmt||!strcmp(fmt,"text")) {
+		cli->outfmt=NULL;
+		return 0;
+	}
+	for (f=cli->flts;f;f=f->next)
+		if (f->row&&!strcmp(f->cmd,fmt)) {
+			cli->outfmt=f;
+			return 0;
+		}
+	return -1;
+} // }}}
+
+inline void yacli_set_paste_exec(yacli *cli,int on) { // {{{
+	if (!cli)
+		return;
+
+	cli->pastexec=!!on;
+} // }}}
+
+inline void yacli_set_sort_mem(yacli *cli,size_t bytes) { // {{{
+	if (!cli)
+		return;
+	cli->sortmem=bytes?bytes:SORT_MEM;
+} // }}}
+
+inline void yacli_set_more(yacli *cli,int on) { // {{{
+	if (!cli)
+		return;
+	cli->more=!!on;
+} // }}}
+
+inline void yacli_set_more_clear(yacli *cli,int ln,int pg,int co,int qu) { // {{{
+	if (!cli)
+		return;
+	cli->clearmorel=!!ln;
+	cli->clearmorep=!!pg;
+	cli->clearmorec=!!co;
+	cli->clearmoreq=!!qu;
+} // }}}
+
+inline void yacli_set_ctrlz(yacli *cli,int on) { // {{{
+	if (!cli)
+		return;
+	cli->handlectrlz=!!on;
+} // }}}
+
+inline void yacli_set_ctrlz_exec(yacli *cli,int on) { // {{{
+	if (!cli)
+		return;
+	cli->ctrlzexeccmd=!!on;
+} // }}}
+
+inline void yacli_set_banner(yacli *cli,const char *banner) { // {{{
+	char *t;
+
+	if (!cli)
+		return;
+
+	t=cli->banner;
+	cli->banner=strdup(banner);
+	if (!cli->banner)
+		cli->banner=t;
+	else
+		free(t);
+} // }}}
+
+inline void yacli_set_level(yacli *cli,const char *level) { // {{{
+	char *t;
+
+	if (!cli)
+		return;
+
+	t=cli->level;
+	cli->level=strdup(level);
+	if (!cli->level)
+		cli->level=t;
+	else
+		free(t);
+	yacli_gen_prompt(cli);
+} // }}}
+
+inline void yacli_set_hostname(yacli *cli,const char *hostname) { // {{{
+	char *t;
+
+	if (!cli)
+		return;
+
+	t=cli->hostname;
+	cli->hostname=strdup(hostname);
+	if (!cli->hostname)
+		cli->hostname=t;
+	else
+		free(t);
+	yacli_gen_prompt(cli);
+} // }}}
+
+static inline void yacli_more_prompt(yacli *cli) { // {{{
+	if (!cli)
+		return;
+
+	cli->scrok=0;
+	yascreen_clearln(cli->s);
+	yascreen_puts(cli->s,"\r");
+	yascreen_puts(cli->s,cli->moreprompt);
+	yascreen_write(cli->s,"",0);
+} // }}}
+
+static inline void yacli_more_clear_prompt(yacli *cli,more_type t) { // {{{
+	if (!cli)
+		return;
+
+	switch (t) {
+		case MORE_LINE:
+			if (cli->clearmorel) {
+				yascreen_clearln(cli->s);
+				yascreen_puts(cli->s,"\r"); // clear more prompt
+			} else
+				yascreen_puts(cli->s,"\r\n"); // go next line
+			break;
+		case MORE_PAGE:
+			if (cli->clearmorep) {
+				yascreen_clearln(cli->s);
+				yascreen_puts(cli->s,"\r"); // clear more prompt
+			} else
+				yascreen_puts(cli->s,"\r\n"); // go next line
+			break;
+		case MORE_QUIT:
+			if (cli->clearmoreq) {
+				yascreen_clearln(cli->s);
+				yascreen_puts(cli->s,"\r"); // clear more prompt
+			} else
+				yascreen_puts(cli->s," quit\r\n"); // print the reason and go next line
+			break;
+		case MORE_CONT:
+			if (cli->clearmorec) {
+				yascreen_clearln(cli->s);
+				yascreen_puts(cli->s,"\r"); // clear more prompt
+			} else
+				yascreen_puts(cli->s,"\r\n"); // go next line
+			break;
+		case MORE_CTRC:
+			yascreen_puts(cli->s," ^C\r\n"); // print the reason and go next line
+			break;
+		case MORE_NONE:
+			break;
+	}
+	yascreen_write(cli->s,"",0);
+} // }}}
+
+static inline int yacli_vfmt(yacli *cli,const char *format,va_list ap) { // {{{
+	// format into the reusable session buffer
+	// return formatted length or -1 on error
+	va_list aq;
+	int size;
+
+	va_copy(aq,ap);
+	size=vsnprintf(cli->fmtbuf,cli->fmtsiz,format,aq);
+	va_end(aq);
+
+	if (size<0) // some error, nothing more to do
+		return -1;
+
+	if (size>=cli->fmtsiz) { // does not fit, grow and retry once
+		int len=0;
+
+		if (yacli_buf_inc(&cli->fmtbuf,&cli->fmtsiz,&len,size+1)) // no memory
+			return -1;
+		size=vsnprintf(cli->fmtbuf,cli->fmtsiz,format,ap);
+		if (size<0||size>=cli->fmtsiz)
+			return -1;
+	}
+
+	return size;
+} // }}}
+
+static inline int yacli_print_nof(yacli *cli,const char *format,...) { // {{{
+	va_list ap;
+	int size;
+
+	if (!cli)
+		return -1;
+	if (cli->pxrun) // failed paste lines are reported at the end
+		return 0;
+
+	va_start(ap,format);
+	size=yacli_vfmt(cli,format,ap);
+	va_end(ap);
+
+	if (size==-1) // some error, nothing more to do
+		return size;
+
+	yacli_write_nof(cli,cli->fmtbuf,size);
+
+	return size;
+} // }}}
+
+typedef struct _opipe {
+	pthread_t thr; // worker thread running the filter chain
+	pthread_mutex_t mtx; // protects out and the sleep/eof/fin flags
+	pthread_cond_t cnd; // wakes up producer or worker
+	yacli *cli; // owning cli
+	char *ring; // command output waiting for filters
+	char *out; // filtered output waiting for the loop thread
+	char *spare; // swapped with out on drain
+	char *wout; // filtered output collected by worker, not yet handed back
+	size_t head; // ring write position, written only by producer
+	size_t tail; // ring read position, written only by worker
+	int outsiz; // out alloc size
+	int outlen; // out data len
+	int sparesiz; // spare alloc size
+	int woutsiz; // wout alloc size
+	int woutlen; // wout data len
+	int wsleep; // worker waits for data
+	int psleep; // producer waits for space or output
+	int osleep; // worker waits for out to be drained
+	int eof; // producer has finished
+	int fin; // worker has finished
+} opipe;
+
+static inline void yacli_opipe_wake(opipe *p) { // {{{
+	// tell the loop thread there is something to drain
+	uint64_t one=1;
+
+	if (p->cli->outfd!=-1&&write(p->cli->outfd,&one,sizeof one)<0) // eventfd or pipe; when full, a wake up is pending anyway
+		return;
+} // }}}
+
+static inline void yacli_opipe_publish(opipe *p) { // {{{
+	// hand collected output back to the loop thread; wait while out is full
+	int wake;
+
+	if (!p->woutlen)
+		return;
+	pthread_mutex_lock(&p->mtx);
+	while (p->outlen&&p->outlen+p->woutlen>OPIPE_SIZE) { // bounded buffering
+		p->osleep=1;
+		if (p->psleep)
+			pthread_cond_broadcast(&p->cnd);
+		pthread_cond_wait(&p->cnd,&p->mtx);
+		p->osleep=0;
+	}
+	wake=!p->outlen;
+	if (!yacli_buf_inc(&p->out,&p->outsiz,&p->outlen,p->woutlen)) {
+		memcpy(p->out+p->outlen,p->wout,p->woutlen);
+		__atomic_store_n(&p->outlen,p->outlen+p->woutlen,__ATOMIC_SEQ_CST);
+	}
+	p->woutlen=0;
+	if (p->psleep)
+		pthread_cond_broadcast(&p->cnd);
+	pthread_mutex_unlock(&p->mtx);
+	if (wake)
+		yacli_opipe_wake(p);
+} // }}}
+
+static inline int yacli_filter_feed_async(filter_inst *fltr,const char *line,int len) { // {{{
+	opipe *p;
+
+	if (!fltr)
+		return -1;
+	if (!fltr->fltr)
+		return -1;
+	if (!fltr->fltr->cli)
+		return -1;
+	if (!fltr->fltr->cli->opipe)
+		return -1;
+
+	p=fltr->fltr->cli->opipe;
+	if (yacli_buf_inc(&p->wout,&p->woutsiz,&p->woutlen,len)) // no memory
+		return -1;
+	memcpy(p->wout+p->woutlen,line,len);
+	p->woutlen+=len;
+	if (p->woutlen>=OPIPE_SIZE) // filters may produce a lot from done, do not wait for it
+		yacli_opipe_publish(p);
+	return len;
+} // }}}
+
+static void *yacli_opipe_worker(void *arg) { // {{{
+	opipe *p=arg;
+	yacli *cli=p->cli;
+
+	for (;;) {
+		size_t h=__atomic_load_n(&p->head,__ATOMIC_SEQ_CST);
+		size_t n;
+
+		if (h==p->tail) { // ring is empty
+			pthread_mutex_lock(&p->mtx);
+			__atomic_store_n(&p->wsleep,1,__ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&p->head,__ATOMIC_SEQ_CST)==p->tail&&!p->eof)
+				pthread_cond_wait(&p->cnd,&p->mtx);
+			__atomic_store_n(&p->wsleep,0,__ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&p->head,__ATOMIC_SEQ_CST)==p->tail&&p->eof) {
+				pthread_mutex_unlock(&p->mtx);
+				break;
+			}
+			pthread_mutex_unlock(&p->mtx);
+			continue;
+		}
 
-	if (!cli->parsedcmd) {
-		cli->parsedcmd=calloc(sizeof(char *),step);
-		if (!cli->parsedcmd) { // memory alloc error
-			free(dw);
-			return;
+		n=mymin(h-p->tail,OPIPE_SIZE-(p->tail&(OPIPE_SIZE-1))); // contiguous part
+		if (!yacli_nomore(cli)) {
+			cli->fcmd->fltr->feed(cli->fcmd,p->ring+(p->tail&(OPIPE_SIZE-1)),n);
+			yacli_infull_check(cli);
 		}
-		cli->parsedcnt=0;
-		cli->parsedsiz=step;
+		__atomic_store_n(&p->tail,p->tail+n,__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&p->psleep,__ATOMIC_SEQ_CST)) { // producer waits for space
+			pthread_mutex_lock(&p->mtx);
+			pthread_cond_broadcast(&p->cnd);
+			pthread_mutex_unlock(&p->mtx);
+		}
+		yacli_opipe_publish(p);
 	}
-	if (cli->parsedcnt>=cli->parsedsiz) {
-		int cnt=cli->parsedcnt+2; // one for terminating NULL, one for the new item
-		char **nc=calloc(sizeof(char *),step*(cnt/step+1));
 
-		if (!nc) { // memory alloc error
-			free(dw);
-			return;
-		}
-		memcpy(nc,cli->parsedcmd,(cli->parsedcnt+1)*sizeof(char *));
-		free(cli->parsedcmd);
-		cli->parsedcmd=nc;
-		cli->parsedsiz=step*(cnt/step+1);
-	}
+	if (cli->fcmd->fltr->done)
+		cli->fcmd->fltr->done(cli->fcmd);
+	yacli_opipe_publish(p);
+
+	pthread_mutex_lock(&p->mtx);
+	p->fin=1;
+	pthread_cond_broadcast(&p->cnd);
+	pthread_mutex_unlock(&p->mtx);
+	yacli_opipe_wake(p);
+	return NULL;
+} // }}}
+
+static inline void yacli_opipe_drain(yacli *cli) { // {{{
+	// write output handed back by the worker; only on the loop thread
+	opipe *p;
+	char *t;
+	int ts,len;
+
+	if (!cli)
+		return;
+	if (!cli->opipe)
+		return;
+
+	p=cli->opipe;
+	if (!__atomic_load_n(&p->outlen,__ATOMIC_SEQ_CST))
+		return;
+
+	pthread_mutex_lock(&p->mtx);
+	t=p->out;
+	ts=p->outsiz;
+	len=p->outlen;
+	p->out=p->spare;
+	p->outsiz=p->sparesiz;
+	p->outlen=0;
+	p->spare=t;
+	p->sparesiz=ts;
+	if (p->osleep)
+		pthread_cond_broadcast(&p->cnd);
+	pthread_mutex_unlock(&p->mtx);
+
+	yacli_write_nof(cli,p->spare,len);
+} // }}}
+
+static inline int yacli_opipe_push(yacli *cli,const char *s,size_t len) { // {{{
+	// copy command output into the ring, wait for space when it is full
+	size_t total=len;
+	opipe *p;
+
+	if (!cli)
+		return -1;
+	if (!cli->opipe)
+		return -1;
+
+	p=cli->opipe;
+	if (p->eof) // command is done, its output is still being filtered
+		return -1;
+	while (len) {
+		size_t t=__atomic_load_n(&p->tail,__ATOMIC_SEQ_CST);
+		size_t n=OPIPE_SIZE-(p->head-t);
+
+		yacli_opipe_drain(cli);
+		if (yacli_nomore(cli))
+			return YACLI_OUTPUT_DONE;
+
+		if (!n) { // ring is full, back-pressure
+			pthread_mutex_lock(&p->mtx);
+			__atomic_store_n(&p->psleep,1,__ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&p->tail,__ATOMIC_SEQ_CST)==t&&!p->outlen)
+				pthread_cond_wait(&p->cnd,&p->mtx);
+			__atomic_store_n(&p->psleep,0,__ATOMIC_SEQ_CST);
+			pthread_mutex_unlock(&p->mtx);
+			continue;
+		}
+
+		n=mymin(n,len);
+		n=mymin(n,OPIPE_SIZE-(p->head&(OPIPE_SIZE-1))); // contiguous part
+		memcpy(p->ring+(p->head&(OPIPE_SIZE-1)),s,n);
+		__atomic_store_n(&p->head,p->head+n,__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&p->wsleep,__ATOMIC_SEQ_CST)) { // worker waits for data
+			pthread_mutex_lock(&p->mtx);
+			pthread_cond_broadcast(&p->cnd);
+			pthread_mutex_unlock(&p->mtx);
+		}
+		s+=n;
+		len-=n;
+	}
+	return total;
+} // }}}
+
+static inline void yacli_opipe_free(yacli *cli) { // {{{
+	opipe *p;
+
+	if (!cli)
+		return;
+	if (!cli->opipe)
+		return;
+
+	p=cli->opipe;
+	pthread_mutex_destroy(&p->mtx);
+	pthread_cond_destroy(&p->cnd);
+	if (p->ring)
+		free(p->ring);
+	if (p->out)
+		free(p->out);
+	if (p->spare)
+		free(p->spare);
+	if (p->wout)
+		free(p->wout);
+	free(p);
+	cli->opipe=NULL;
+	cli->noopi.fltr=&cli->noopf; // output goes to screen again
+} // }}}
+
+static inline void yacli_opipe_start(yacli *cli) { // {{{
+	// start worker thread for the filter chain of current command; stay synchronous on error
+	opipe *p;
+
+	if (!cli)
+		return;
+	if (cli->opipe)
+		return;
+
+	p=calloc(1,sizeof *p);
+	if (!p)
+		return;
+	p->cli=cli;
+	p->ring=malloc(OPIPE_SIZE);
+	if (!p->ring) {
+		free(p);
+		return;
+	}
+	pthread_mutex_init(&p->mtx,NULL);
+	pthread_cond_init(&p->cnd,NULL);
+
+	cli->asyncf=cli->noopf;
+	cli->asyncf.cmd="async";
+	cli->asyncf.feed=yacli_filter_feed_async;
+	cli->asyncf.feedv=NULL; // feed is called per fragment
+	cli->noopi.fltr=&cli->asyncf; // chain ends in handback instead of screen
+	cli->opipe=p;
+
+	if (pthread_create(&p->thr,NULL,yacli_opipe_worker,p))
+		yacli_opipe_free(cli);
+} // }}}
+
+static inline void yacli_opipe_eof(yacli *cli) { // {{{
+	// signal end of command output, the worker goes on with the rest of the chain
+	opipe *p;
+
+	if (!cli)
+		return;
+	if (!cli->opipe)
+		return;
+
+	p=cli->opipe;
+	pthread_mutex_lock(&p->mtx);
+	p->eof=1;
+	pthread_cond_broadcast(&p->cnd);
+	pthread_mutex_unlock(&p->mtx);
+} // }}}
+
+static inline int yacli_opipe_poll(yacli *cli,int wait) { // {{{
+	// write output handed back so far; once the worker has finished, stop it and free the chain
+	// with wait block until then; return 1 while the worker still runs
+	opipe *p;
+
+	if (!cli)
+		return 0;
+	if (!cli->opipe)
+		return 0;
+
+	p=cli->opipe;
+	for (;;) {
+		int fin;
+
+		yacli_opipe_drain(cli);
+		pthread_mutex_lock(&p->mtx);
+		fin=p->fin&&!p->outlen;
+		if (wait&&!fin&&!p->outlen) {
+			__atomic_store_n(&p->psleep,1,__ATOMIC_SEQ_CST);
+			pthread_cond_wait(&p->cnd,&p->mtx);
+			__atomic_store_n(&p->psleep,0,__ATOMIC_SEQ_CST);
+		}
+		pthread_mutex_unlock(&p->mtx);
+		if (fin)
+			break;
+		if (!wait)
+			return 1;
+	}
+	pthread_join(p->thr,NULL);
+	yacli_opipe_free(cli);
+	cli->chaindone=1; // worker has called done
+	yacli_free_fcmd(cli);
+	return 0;
+} // }}}
+
+inline int yacli_write(yacli *cli,const char *s,size_t len) { // {{{
+	int ret;
+
+	if (!cli)
+		return -1;
+	if (!cli->fcmd)
+		return -1;
+	if (!cli->fcmd->fltr)
+		return -1;
+	if (!cli->fcmd->fltr->feed)
+		return -1;
+	if (yacli_nomore(cli)) // filters have all they need
+		return YACLI_OUTPUT_DONE;
+
+	if (cli->opipe) // filters run in worker thread
+		ret=yacli_opipe_push(cli,s,len);
+	else {
+		ret=cli->fcmd->fltr->feed(cli->fcmd,s,len);
+		yacli_infull_check(cli);
+	}
+
+	return yacli_nomore(cli)?YACLI_OUTPUT_DONE:ret;
+} // }}}
+
+inline int yacli_print(yacli *cli,const char *format,...) { // {{{
+	va_list ap;
+	int size;
+
+	if (!cli)
+		return -1;
+	if (!cli->fcmd)
+		return -1;
+	if (!cli->fcmd->fltr)
+		return -1;
+	if (!cli->fcmd->fltr->feed)
+		return -1;
+	if (yacli_nomore(cli)) // filters have all they need, skip formatting too
+		return YACLI_OUTPUT_DONE;
+
+	va_start(ap,format);
+	size=yacli_vfmt(cli,format,ap);
+	va_end(ap);
+
+	if (size==-1) // some error, nothing more to do
+		return size;
+
+	if (cli->opipe) // filters run in worker thread
+		yacli_opipe_push(cli,cli->fmtbuf,size);
+	else {
+		cli->fcmd->fltr->feed(cli->fcmd,cli->fmtbuf,size);
+		yacli_infull_check(cli);
+	}
+
+	return yacli_nomore(cli)?YACLI_OUTPUT_DONE:size;
+} // }}}
+
+inline int yacli_writev(yacli *cli,const struct iovec *iov,int iovcnt) { // {{{
+	int ret;
+
+	if (!cli)
+		return -1;
+	if (!cli->fcmd)
+		return -1;
+	if (!iov||iovcnt<0)
+		return -1;
+	if (yacli_nomore(cli)) // filters have all they need
+		return YACLI_OUTPUT_DONE;
+
+	if (cli->opipe) { // filters run in worker thread
+		int k;
+
+		for (k=0,ret=0;k<iovcnt&&ret>=0;k++)
+			if (yacli_opipe_push(cli,iov[k].iov_base,iov[k].iov_len)>=0)
+				ret+=iov[k].iov_len;
+			else
+				ret=-1;
+	} else {
+		ret=yacli_filter_feedv(cli->fcmd,iov,iovcnt);
+		yacli_infull_check(cli);
+	}
+
+	return yacli_nomore(cli)?YACLI_OUTPUT_DONE:ret;
+} // }}}
+
+inline int yacli_output_done(yacli *cli) { // {{{
+	if (!cli)
+		return 1;
+
+	return yacli_nomore(cli);
+} // }}}
+
+static inline void yacli_table_free(yacli *cli) { // {{{
+	table *t;
+	int i;
+
+	if (!cli)
+		return;
+	if (!cli->tbl)
+		return;
+
+	t=cli->tbl;
+	for (i=0;i<t->ncol;i++)
+		free(t->name[i]);
+	if (t->name)
+		free(t->name);
+	if (t->width)
+		free(t->width);
+	if (t->right)
+		free(t->right);
+	if (t->cell)
+		free(t->cell);
+	if (t->num)
+		free(t->num);
+	if (t->arena)
+		free(t->arena);
+	if (t->line)
+		free(t->line);
+	free(t);
+	cli->tbl=NULL;
+} // }}}
+
+inline int yacli_table_begin(yacli *cli) { // {{{
+	if (!cli)
+		return -1;
+
+	yacli_table_free(cli); // drop a table that was not ended
+	cli->tbl=calloc(1,sizeof *cli->tbl);
+	if (!cli->tbl)
+		return -1;
+	return yacli_nomore(cli)?YACLI_OUTPUT_DONE:0;
+} // }}}
+
+inline int yacli_table_col(yacli *cli,const char *name,int right) { // {{{
+	table *t;
+
+	if (!cli)
+		return -1;
+	if (!cli->tbl)
+		return -1;
+	if (!name)
+		return -1;
+
+	t=cli->tbl;
+	if (t->rows||t->cur) // columns cannot change after data is pushed
+		return -1;
+
+	if (t->ncol>=t->colsiz) {
+		int ns=t->colsiz+16;
+		char **nn=realloc(t->name,ns*sizeof *nn);
+		int *nw;
+		uint8_t *nr;
+
+		if (!nn)
+			return -1;
+		t->name=nn;
+		nw=realloc(t->width,ns*sizeof *nw);
+		if (!nw)
+			return -1;
+		t->width=nw;
+		nr=realloc(t->right,ns*sizeof *nr);
+		if (!nr)
+			return -1;
+		t->right=nr;
+		t->colsiz=ns;
+	}
+	t->name[t->ncol]=strdup(name);
+	if (!t->name[t->ncol])
+		return -1;
+	t->width[t->ncol]=strlen(name);
+	t->right[t->ncol]=!!right;
+	t->ncol++;
+	return 0;
+} // }}}
+
+static inline void yacli_table_pad(table *t,int *ll,int n) { // {{{
+	memset(t->line+*ll,' ',n);
+	*ll+=n;
+} // }}}
+
+static inline int yacli_table_flush(yacli *cli) { // {{{
+	// calculate widths for the window, render it into text fitted to screen width and write it
+	int i,j,ll=0,avail,fit;
+	table *t;
+
+	if (!cli)
+		return -1;
+	if (!cli->tbl)
+		return -1;
+
+	t=cli->tbl;
+	if (!t->ncol||(!t->rows&&t->header))
+		return 0;
+
+	for (j=0;j<t->rows;j++)
+		for (i=0;i<t->ncol;i++)
+			t->width[i]=mymax(t->width[i],(int)strlen(t->arena+t->cell[j*t->ncol+i]));
+
+	// fit columns into screen width, cutting from the right
+	avail=cli->sx-1;
+	for (fit=0;fit<t->ncol;fit++) {
+		if (avail<=0)
+			break;
+		avail-=t->width[fit]+2; // two spaces separate columns
+	}
+
+	// worst case each line is screen wide plus new line
+	if (yacli_buf_inc(&t->line,&t->linesiz,&ll,(t->rows+1)*(cli->sx+1)))
+		return -1;
+
+	for (j=t->header?0:-1;j<t->rows;j++) {
+		int sp=cli->sx-1;
+		int lastll=ll;
+
+		for (i=0;i<fit;i++) {
+			const char *c=j<0?t->name[i]:t->arena+t->cell[j*t->ncol+i];
+			int cl=strlen(c);
+			int w=mymin(t->width[i],sp);
+
+			if (w<=0)
+				break;
+			if (cl>w) // cut to screen width
+				cl=w;
+			if (t->right[i])
+				yacli_table_pad(t,&ll,w-cl);
+			memcpy(t->line+ll,c,cl);
+			ll+=cl;
+			if (!t->right[i]&&i+1<fit)
+				yacli_table_pad(t,&ll,w-cl);
+			sp-=w;
+			if (i+1<fit&&sp>2) {
+				yacli_table_pad(t,&ll,2);
+				sp-=2;
+			} else
+				sp=0;
+		}
+		while (ll>lastll&&t->line[ll-1]==' ') // do not send trailing spaces
+			ll--;
+		t->line[ll++]='\n';
+	}
+	t->header=1;
+	t->rows=0;
+	t->arenalen=0;
+
+	return yacli_write(cli,t->line,ll)<0?YACLI_OUTPUT_DONE:0;
+} // }}}
+
+static inline filter_inst *yacli_table_rec(yacli *cli) { // {{{
+	// first filter takes rows as records
+	if (cli->fcmd&&cli->fcmd->fltr&&cli->fcmd->fltr->row)
+		return cli->fcmd;
+	return NULL;
+} // }}}
+
+static inline int yacli_table_add(yacli *cli,const char *val,int len,int num) { // {{{
+	table *t;
+	int n;
+
+	if (!cli)
+		return -1;
+	if (!cli->tbl)
+		return -1;
+	if (yacli_nomore(cli)) // nobody is interested in more rows
+		return YACLI_OUTPUT_DONE;
+
+	t=cli->tbl;
+	if (t->cur>=t->ncol) // extra cells are ignored
+		return 0;
+
+	n=t->rows*t->ncol+t->cur;
+	if (n>=t->cellsiz) {
+		int ns=t->cellsiz+TABLE_WINDOW*t->ncol;
+		int *nc=realloc(t->cell,ns*sizeof *nc);
+		uint8_t *nn;
+
+		if (!nc)
+			return -1;
+		t->cell=nc;
+		nn=realloc(t->num,ns*sizeof *nn);
+		if (!nn)
+			return -1;
+		t->num=nn;
+		t->cellsiz=ns;
+	}
+	if (yacli_buf_inc(&t->arena,&t->arenasiz,&t->arenalen,len+1))
+		return -1;
+	t->cell[n]=t->arenalen;
+	t->num[n]=!!num;
+	memcpy(t->arena+t->arenalen,val,len);
+	t->arena[t->arenalen+len]=0;
+	t->arenalen+=len+1;
+	t->cur++;
+	return 0;
+} // }}}
+
+inline int yacli_table_str(yacli *cli,const char *val) { // {{{
+	if (!val)
+		val="";
+	return yacli_table_add(cli,val,strlen(val),0);
+} // }}}
+
+inline int yacli_table_int(yacli *cli,long long val) { // {{{
+	char s[32];
+
+	return yacli_table_add(cli,s,snprintf(s,sizeof s,"%lld",val),1);
+} // }}}
+
+inline int yacli_table_uint(yacli *cli,unsigned long long val) { // {{{
+	char s[32];
+
+	return yacli_table_add(cli,s,snprintf(s,sizeof s,"%llu",val),1);
+} // }}}
+
+inline int yacli_table_row(yacli *cli) { // {{{
+	filter_inst *rec;
+	table *t;
+
+	if (!cli)
+		return -1;
+	if (!cli->tbl)
+		return -1;
+	if (yacli_nomore(cli))
+		return YACLI_OUTPUT_DONE;
+
+	t=cli->tbl;
+	while (t->cur<t->ncol) // fill missing cells
+		if (yacli_table_add(cli,"",0,0))
+			return -1;
+	t->cur=0;
+	t->rows++;
+	if ((rec=yacli_table_rec(cli))) { // structured output, no layout
+		int ret=rec->fltr->row(rec,t,0);
+
+		t->rows=0;
+		t->arenalen=0;
+		yacli_infull_check(cli);
+		if (yacli_nomore(cli))
+			return YACLI_OUTPUT_DONE;
+		return ret<0?-1:0;
+	}
+	if (t->rows>=TABLE_WINDOW)
+		return yacli_table_flush(cli);
+	return 0;
+} // }}}
+
+inline int yacli_table_end(yacli *cli) { // {{{
+	int ret;
+
+	if (!cli)
+		return -1;
+	if (!cli->tbl)
+		return -1;
+
+	if (cli->tbl->cur) // finish incomplete row
+		yacli_table_row(cli);
+	if (yacli_nomore(cli))
+		ret=YACLI_OUTPUT_DONE;
+	else
+		ret=yacli_table_rec(cli)?0:yacli_table_flush(cli);
+	yacli_table_free(cli);
+	return ret;
+} // }}}
+
+static inline int yacli_promptlen(yacli *cli) { // {{{
+	int promptlen;
+
+	if (!cli)
+		return 0;
+
+	// "hostname(mode1-mode2-mode3)# "
+	promptlen=cli->pfxlen+1;
+	return promptlen;
+} // }}}
+
+static inline int yacli_search_promptlen(yacli *cli) { // {{{
+	int promptlen;
+
+	if (!cli)
+		return 0;
+
+	// "(i-search)'sbuf': result"
+	promptlen=strlen("(i-search)");
+	promptlen+=2; // quotes
+	promptlen+=cli->slen; // search buffer
+	promptlen+=2; // colon space
+	return promptlen;
+} // }}}
+
+static inline int yacli_dispspace(yacli *cli) { // {{{
+	if (!cli)
+		return 0;
 
-	cli->parsedcmd[cli->parsedcnt++]=dw;
-	cli->parsedcmd[cli->parsedcnt]=NULL;
+	return cli->dspace;
 } // }}}
 
-inline void yacli_set_more(yacli *cli,int on) { // {{{
+static inline int yacli_search_dispspace(yacli *cli) { // {{{
 	if (!cli)
-		return;
-	cli->more=!!on;
+		return 0;
+
+	return cli->sx-yacli_search_promptlen(cli)-1; // last char cannot be used
 } // }}}
 
-inline void yacli_set_more_clear(yacli *cli,int ln,int pg,int co,int qu) { // {{{
+static inline int yacli_linelen(yacli *cli) { // {{{
+	int linelen;
+
 	if (!cli)
-		return;
-	cli->clearmorel=!!ln;
-	cli->clearmorep=!!pg;
-	cli->clearmorec=!!co;
-	cli->clearmoreq=!!qu;
+		return 0;
+
+	linelen=cli->buflen-cli->bufpos;
+	if (linelen>yacli_dispspace(cli))
+		linelen=yacli_dispspace(cli)-1;
+
+	return linelen;
 } // }}}
 
-inline void yacli_set_ctrlz(yacli *cli,int on) { // {{{
+static inline int yacli_search_linelen(yacli *cli) { // {{{
+	int linelen;
+
 	if (!cli)
-		return;
-	cli->handlectrlz=!!on;
+		return 0;
+
+	linelen=0;
+	if (cli->rcmd)
+		linelen=cli->rcmdlen;
+	if (linelen>yacli_search_dispspace(cli))
+		linelen=yacli_search_dispspace(cli)-1;
+
+	return linelen;
 } // }}}
 
-inline void yacli_set_ctrlz_exec(yacli *cli,int on) { // {{{
+static inline char yacli_begc(yacli *cli) { // {{{
+	char begc;
+
 	if (!cli)
-		return;
-	cli->ctrlzexeccmd=!!on;
+		return 0;
+
+	begc=cli->bufpos?'$':' ';
+
+	return begc;
 } // }}}
 
-inline void yacli_set_banner(yacli *cli,const char *banner) { // {{{
-	char *t;
+static inline char *yacli_endc(yacli *cli) { // {{{
+	char *endc="";
+	int linelen;
 
 	if (!cli)
-		return;
+		return 0;
 
-	t=cli->banner;
-	cli->banner=strdup(banner);
-	if (!cli->banner)
-		cli->banner=t;
-	else
-		free(t);
+	linelen=cli->buflen-cli->bufpos;
+	if (linelen>yacli_dispspace(cli))
+		endc="$";
+
+	return endc;
 } // }}}
 
-inline void yacli_set_level(yacli *cli,const char *level) { // {{{
-	char *t;
+static inline char *yacli_search_endc(yacli *cli) { // {{{
+	char *endc="";
+	int linelen;
 
 	if (!cli)
-		return;
+		return 0;
 
-	t=cli->level;
-	cli->level=strdup(level);
-	if (!cli->level)
-		cli->level=t;
+	linelen=0;
+	if (cli->rcmd)
+		linelen=cli->rcmdlen;
+	if (linelen>yacli_search_dispspace(cli))
+		endc="$";
+
+	return endc;
+} // }}}
+
+static inline int yacli_bufpos_shiftr(yacli *cli) { // {{{
+	if (!cli)
+		return 0;
+
+	if (cli->buflen-cli->bufpos<yacli_dispspace(cli)) // no right truncate or exact right end - do not shift
+		return 0;
+
+	if (cli->cursor-cli->bufpos>=yacli_dispspace(cli)-2) // shift is needed
+		return 1;
+
+	return 0;
+} // }}}
+
+static inline void yacli_search_prompt(yacli *cli) { // {{{
+	int promptlen=yacli_search_promptlen(cli);
+	int linelen=yacli_search_linelen(cli);
+	char *endc=yacli_search_endc(cli);
+	char *sbuf=cli->sbuf?cli->sbuf:"";
+	const char *rcmd=cli->rcmd?cli->rcmd:"";
+
+	cli->scrok=0;
+	yascreen_print(cli->s,"%s\r(i-search)'%s': %.*s%s\r\e[%dC",yascreen_clearln_s(cli->s),sbuf,linelen,rcmd,endc,promptlen-3);
+	yascreen_write(cli->s,"",0);
+} // }}}
+
+static inline int yacli_prompt_app(yacli *cli,const char *s,int len) { // {{{
+	if (yacli_buf_inc(&cli->scrnew,&cli->scrnewsiz,&cli->scrnewlen,len))
+		return -1;
+	memcpy(cli->scrnew+cli->scrnewlen,s,len);
+	cli->scrnewlen+=len;
+	return 0;
+} // }}}
+
+static inline void yacli_prompt_move(yacli *cli,int from,int to) { // {{{
+	// relative cursor move on prompt line; short moves right rewrite the rendered text
+	if (to==from)
+		return;
+	if (to>from) {
+		if (to-from<=3)
+			yascreen_write(cli->s,cli->scrnew+from,to-from);
+		else
+			yascreen_print(cli->s,"\e[%dC",to-from);
+	} else if (!to)
+		yascreen_puts(cli->s,"\r");
+	else if (from-to==1)
+		yascreen_puts(cli->s,"\b");
 	else
-		free(t);
-	cli->redraw=1;
+		yascreen_print(cli->s,"\e[%dD",from-to);
 } // }}}
 
-inline void yacli_set_hostname(yacli *cli,const char *hostname) { // {{{
+static inline void yacli_prompt_diff(yacli *cli,int curpos) { // {{{
+	// change prompt line on screen from scrbuf to scrnew: append, insert or delete chars in the middle, or rewrite the tail
+	const char *o=cli->scrbuf;
+	const char *n=cli->scrnew;
+	int lo=cli->scrlen,ln=cli->scrnewlen;
+	int p=0,s=0,om,nm;
+	int cur=cli->scrcur;
+
+	while (p<lo&&p<ln&&o[p]==n[p])
+		p++;
+	while (s<lo-p&&s<ln-p&&o[lo-1-s]==n[ln-1-s])
+		s++;
+	om=lo-p-s;
+	nm=ln-p-s;
+	if (om||nm) {
+		yacli_prompt_move(cli,cur,p);
+		if (s&&!om) { // insert chars, the rest shifts right
+			yascreen_print(cli->s,"\e[%d@",nm);
+			yascreen_write(cli->s,n+p,nm);
+			cur=p+nm;
+		} else if (s&&!nm) { // delete chars, the rest shifts left
+			yascreen_print(cli->s,"\e[%dP",om);
+			cur=p;
+		} else if (s&&om==nm) { // overwrite in place
+			yascreen_write(cli->s,n+p,nm);
+			cur=p+nm;
+		} else { // rewrite the tail
+			yascreen_write(cli->s,n+p,ln-p);
+			if (ln<lo)
+				yascreen_puts(cli->s,"\e[K");
+			cur=ln;
+		}
+	}
+	yacli_prompt_move(cli,cur,curpos);
+} // }}}
+
+static inline void yacli_prompt(yacli *cli) { // {{{
+	int promptlen;
+	int linelen;
+	char begc;
+	char *endc;
+	int curpos;
 	char *t;
+	int ts;
+	int gl;
 
 	if (!cli)
 		return;
 
-	t=cli->hostname;
-	cli->hostname=strdup(hostname);
-	if (!cli->hostname)
-		cli->hostname=t;
+	promptlen=yacli_promptlen(cli);
+	linelen=yacli_linelen(cli);
+	begc=yacli_begc(cli);
+	endc=yacli_endc(cli);
+
+	if (cli->state==IN_SEARCH) {
+		yacli_search_prompt(cli);
+		return;
+	} else if (cli->state==IN_MORE) {
+		yacli_more_prompt(cli);
+		return;
+	} else if (cli->state==IN_OUTPUT) // prompt comes after the output
+		return;
+
+	cli->lines=0;
+
+	curpos=cli->cursor-cli->bufpos; // zero based in buffer
+	curpos+=promptlen;
+
+	gl=mymax(0,mymin(linelen,cli->gappos-cli->bufpos)); // visible text before the edit gap
+	cli->scrnewlen=0;
+	if (yacli_prompt_app(cli,cli->pfx,cli->pfxlen)||
+		yacli_prompt_app(cli,&begc,1)||
+		yacli_prompt_app(cli,cli->buffer+cli->bufpos,gl)||
+		yacli_prompt_app(cli,cli->buffer+cli->bufpos+gl+cli->gap,linelen-gl)||
+		yacli_prompt_app(cli,endc,strlen(endc))) { // no memory, try again on next redraw
+		cli->scrok=0;
+		return;
+	}
+
+	if (cli->scrok) // update what is already on screen
+		yacli_prompt_diff(cli,curpos);
 	else
-		free(t);
-	cli->redraw=1;
+		yascreen_print(cli->s,"%s\r%.*s\r\e[%dC",yascreen_clearln_s(cli->s),cli->scrnewlen,cli->scrnew,curpos);
+	cli->redraw=0;
+	yascreen_write(cli->s,"",0);
+
+	// keep rendered line as screen state
+	t=cli->scrbuf;
+	ts=cli->scrsiz;
+	cli->scrbuf=cli->scrnew;
+	cli->scrsiz=cli->scrnewsiz;
+	cli->scrlen=cli->scrnewlen;
+	cli->scrnew=t;
+	cli->scrnewsiz=ts;
+	cli->scrcur=curpos;
+	cli->scrok=1;
 } // }}}
 
-static inline void yacli_more_prompt(yacli *cli) { // {{{
+static inline int yacli_message_app(yacli *cli,const char *line,int len) { // {{{
+	// queue message text, \n is converted to \r\n and a missing new line is added
+	const char *clr=yascreen_clearln_s(cli->s);
+	int cl=strlen(clr)+1;
+
+	if (!cli->msglen) { // reserve room for prompt clear, filled on flush
+		if (yacli_buf_inc(&cli->msgbuf,&cli->msgsiz,&cli->msglen,cl))
+			return -1;
+		cli->msglen=cl;
+	}
+	if (yacli_wr_xlat(&cli->msgbuf,&cli->msgsiz,&cli->msglen,line,len,cli->msglen>cl?cli->msgbuf[cli->msglen-1]:0))
+		return -1;
+	if (len&&line[len-1]!='\n')
+		return yacli_wr_xlat(&cli->msgbuf,&cli->msgsiz,&cli->msglen,"\n",1,0);
+	return 0;
+} // }}}
+
+inline void yacli_message_flush(yacli *cli) { // {{{
+	const char *clr;
+	int cl;
+
 	if (!cli)
 		return;
 
-	yascreen_clearln(cli->s);
-	yascreen_puts(cli->s,"\r");
-	yascreen_puts(cli->s,cli->moreprompt);
-	yascreen_write(cli->s,"",0);
+	if (cli->msgsupp) {
+		char s[64];
+
+		snprintf(s,sizeof s,"%d messages suppressed\n",cli->msgsupp);
+		cli->msgsupp=0;
+		yacli_message_app(cli,s,strlen(s));
+	}
+	if (!cli->msglen)
+		return;
+
+	clr=yascreen_clearln_s(cli->s);
+	cl=strlen(clr)+1;
+	cli->scrok=0;
+	if (!cli->incmdcb) { // clear prompt line in front of the messages
+		memcpy(cli->msgbuf,clr,cl-1);
+		cli->msgbuf[cl-1]='\r';
+		yascreen_write(cli->s,cli->msgbuf,cli->msglen);
+	} else
+		yascreen_write(cli->s,cli->msgbuf+cl,cli->msglen-cl);
+	cli->msglen=0;
+	if (!cli->incmdcb)
+		yacli_prompt(cli);
 } // }}}
 
-static inline void yacli_more_clear_prompt(yacli *cli,more_type t) { // {{{
+inline void yacli_message(yacli *cli,const char *line) { // {{{
 	if (!cli)
 		return;
+	if (!line)
+		return;
 
-	switch (t) {
-		case MORE_LINE:
-			if (cli->clearmorel) {
-				yascreen_clearln(cli->s);
-				yascreen_puts(cli->s,"\r"); // clear more prompt
-			} else
-				yascreen_puts(cli->s,"\r\n"); // go next line
-			break;
-		case MORE_PAGE:
-			if (cli->clearmorep) {
-				yascreen_clearln(cli->s);
-				yascreen_puts(cli->s,"\r"); // clear more prompt
-			} else
-				yascreen_puts(cli->s,"\r\n"); // go next line
-			break;
-		case MORE_QUIT:
-			if (cli->clearmoreq) {
-				yascreen_clearln(cli->s);
-				yascreen_puts(cli->s,"\r"); // clear more prompt
-			} else
-				yascreen_puts(cli->s," quit\r\n"); // print the reason and go next line
-			break;
-		case MORE_CONT:
-			if (cli->clearmorec) {
-				yascreen_clearln(cli->s);
-				yascreen_puts(cli->s,"\r"); // clear more prompt
-			} else
-				yascreen_puts(cli->s,"\r\n"); // go next line
-			break;
-		case MORE_CTRC:
-			yascreen_puts(cli->s," ^C\r\n"); // print the reason and go next line
-			break;
-		case MORE_NONE:
-			break;
+	if (cli->msgrate) {
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC,&ts);
+		if (ts.tv_sec!=cli->msgsec) { // new second
+			cli->msgsec=ts.tv_sec;
+			cli->msgwin=0;
+		}
+		if (cli->msgwin>=cli->msgrate) {
+			cli->msgsupp++;
+			return;
+		}
+		cli->msgwin++;
 	}
-	yascreen_write(cli->s,"",0);
+	if (cli->msglen>MSG_QUEUE) { // nobody flushes, do not grow forever
+		cli->msgsupp++;
+		return;
+	}
+	yacli_message_app(cli,line,strlen(line));
+	if (!cli->msgbatch)
+		yacli_message_flush(cli);
 } // }}}
 
-static inline int yacli_print_nof(yacli *cli,const char *format,...) { // {{{
-	va_list ap;
-	char *ns;
-	int size;
+inline int yacli_message_post(yacli *cli,const char *line) { // {{{
+	// may be called from any thread
+	msgnode *n,*head;
+	size_t len;
+
+	if (!cli)
+		return -1;
+	if (!line)
+		return -1;
+
+	len=strlen(line);
+	n=malloc(sizeof *n+len+1);
+	if (!n)
+		return -1;
+	n->text=(char *)(n+1);
+	memcpy(n->text,line,len+1);
+
+	head=__atomic_load_n(&cli->inq,__ATOMIC_RELAXED);
+	do
+		n->next=head;
+	while (!__atomic_compare_exchange_n(&cli->inq,&head,n,1,__ATOMIC_RELEASE,__ATOMIC_RELAXED));
+
+	if (!head&&cli->msgfd!=-1) { // queue was empty, wake up the session thread
+		uint64_t one=1;
+
+		if (write(cli->msgfd,&one,sizeof one)<0) // eventfd or pipe; when full, a wake up is pending anyway
+			return 0;
+	}
+	return 0;
+} // }}}
+
+inline int yacli_message_drain(yacli *cli) { // {{{
+	// write posted messages; only at a safe point, otherwise they stay queued for a later key or drain
+	msgnode *n,*rev=NULL;
+	int cnt=0,batch;
 
 	if (!cli)
 		return -1;
+	if (cli->incmdcb||cli->state==IN_MORE||cli->state==IN_OUTPUT)
+		return 0;
+	if (!__atomic_load_n(&cli->inq,__ATOMIC_RELAXED))
+		return 0;
 
-	va_start(ap,format);
-	size=vasprintf(&ns,format,ap);
-	va_end(ap);
-
-	if (size==-1) // some error, nothing more to do
-		return size;
+	n=__atomic_exchange_n(&cli->inq,NULL,__ATOMIC_ACQUIRE);
+	while (n) { // restore posting order
+		msgnode *t=n->next;
 
-	yacli_write_nof(cli,ns,strlen(ns));
+		n->next=rev;
+		rev=n;
+		n=t;
+	}
 
-	free(ns);
+	batch=cli->msgbatch;
+	cli->msgbatch=1; // one write for all drained messages
+	while (rev) {
+		n=rev;
+		rev=rev->next;
+		yacli_message(cli,n->text);
+		free(n);
+		cnt++;
+	}
+	cli->msgbatch=batch;
+	if (!batch)
+		yacli_message_flush(cli);
+	return cnt;
+} // }}}
 
-	return size;
+inline void yacli_set_message_fd(yacli *cli,int fd) { // {{{
+	if (!cli)
+		return;
+	cli->msgfd=fd;
 } // }}}
 
-inline int yacli_write(yacli *cli,const char *s,size_t len) { // {{{
+inline void yacli_set_message_batch(yacli *cli,int on,int rate) { // {{{
 	if (!cli)
-		return -1;
-	if (!cli->fcmd)
-		return -1;
-	if (!cli->fcmd->fltr)
-		return -1;
-	if (!cli->fcmd->fltr->feed)
-		return -1;
+		return;
 
-	return cli->fcmd->fltr->feed(cli->fcmd,s,len);
+	cli->msgbatch=!!on;
+	cli->msgrate=rate>0?rate:0;
+	if (!on)
+		yacli_message_flush(cli);
 } // }}}
 
-inline int yacli_print(yacli *cli,const char *format,...) { // {{{
-	va_list ap;
-	char *ns;
-	int size;
+static inline void yacli_eof(yacli *cli) { // {{{
+	if (!cli)
+		return;
+
+	cli->retcode=YACLI_EOF;
+} // }}}
 
+inline void yacli_exit(yacli *cli) { // {{{
 	if (!cli)
-		return -1;
-	if (!cli->fcmd)
-		return -1;
-	if (!cli->fcmd->fltr)
-		return -1;
-	if (!cli->fcmd->fltr->feed)
-		return -1;
+		return;
 
-	va_start(ap,format);
-	size=vasprintf(&ns,format,ap);
-	va_end(ap);
+	yacli_eof(cli);
+} // }}}
 
-	if (size==-1) // some error, nothing more to do
-		return size;
+static inline const char *yacli_hist_get(yacli *cli,int slot,int *len) { // {{{
+	// command text of history slot; text from history file is not zero terminated
+	hslot *h=&cli->hst[slot];
 
-	cli->fcmd->fltr->feed(cli->fcmd,ns,strlen(ns));
+	if (len)
+		*len=h->len;
+	return h->ext?h->ext:cli->harena+h->off;
+} // }}}
 
-	free(ns);
+static inline void yacli_hist_unlink(yacli *cli,int slot) { // {{{
+	int *p=&cli->hbucket[cli->hst[slot].hash&(cli->hbucketn-1)];
 
-	return size;
+	while (*p!=-1&&*p!=slot)
+		p=&cli->hst[*p].hnext;
+	if (*p==slot)
+		*p=cli->hst[slot].hnext;
 } // }}}
 
-static inline int yacli_promptlen(yacli *cli) { // {{{
-	int promptlen;
+static inline void yacli_hist_link(yacli *cli,int slot) { // {{{
+	int *p=&cli->hbucket[cli->hst[slot].hash&(cli->hbucketn-1)];
 
-	if (!cli)
-		return 0;
+	cli->hst[slot].hnext=*p;
+	*p=slot;
+} // }}}
 
-	// "hostname(mode1-mode2-mode3)# "
-	promptlen=strlen(cli->hostname);
-	if (cli->modes&&strlen(cli->modes))
-		promptlen+=strlen(cli->modes); // includes opening and closing braces
-	promptlen+=1+strlen(cli->level);
-	return promptlen;
+static inline int yacli_hist_find(yacli *cli,const char *buf,int len,unsigned hash) { // {{{
+	// slot with the same command text or -1
+	int k;
+
+	for (k=cli->hbucket[hash&(cli->hbucketn-1)];k!=-1;k=cli->hst[k].hnext) {
+		hslot *h=&cli->hst[k];
+
+		if (h->hash==hash&&h->len==len&&!memcmp(yacli_hist_get(cli,k,NULL),buf,len))
+			return k;
+	}
+	return -1;
 } // }}}
 
-static inline int yacli_search_promptlen(yacli *cli) { // {{{
-	int promptlen;
+static inline void yacli_hist_append(yacli *cli,int slot) { // {{{
+	// put slot after the newest command, with a new id
+	hslot *h=&cli->hst[slot];
 
-	if (!cli)
-		return 0;
+	if (h->tnode!=-1) { // trie refs with the old id are stale, it is indexed again with the new one
+		cli->htrielive-=h->len;
+		h->tnode=-1;
+	}
 
-	// "(i-search)'sbuf': result"
-	promptlen=strlen("(i-search)");
-	promptlen+=2; // quotes
-	if (cli->sbuf)
-		promptlen+=strlen(cli->sbuf); // search buffer
-	promptlen+=2; // colon space
-	return promptlen;
+	h->prev=cli->hsttail;
+	h->next=-1;
+	if (cli->hsttail!=-1)
+		cli->hst[cli->hsttail].next=slot;
+	else
+		cli->hsthead=slot;
+	cli->hsttail=slot;
+	h->id=++cli->hstseq;
 } // }}}
 
-static inline int yacli_dispspace(yacli *cli) { // {{{
-	if (!cli)
-		return 0;
+static inline void yacli_hist_detach(yacli *cli,int slot) { // {{{
+	// take slot out of history order
+	hslot *h=&cli->hst[slot];
 
-	return cli->sx-yacli_promptlen(cli)-1; // last char cannot be used
+	if (h->prev!=-1)
+		cli->hst[h->prev].next=h->next;
+	else
+		cli->hsthead=h->next;
+	if (h->next!=-1)
+		cli->hst[h->next].prev=h->prev;
+	else
+		cli->hsttail=h->prev;
 } // }}}
 
-static inline int yacli_search_dispspace(yacli *cli) { // {{{
-	if (!cli)
-		return 0;
+static inline void yacli_hist_unmap(yacli *cli) { // {{{
+	if (cli->hmap)
+		munmap(cli->hmap,cli->hmapsiz);
+	cli->hmap=NULL;
+	cli->hmapsiz=0;
+	cli->hmapcnt=0;
+} // }}}
 
-	return cli->sx-yacli_search_promptlen(cli)-1; // last char cannot be used
+static inline void yacli_hist_remove(yacli *cli,int slot) { // {{{
+	// evict command, its slot becomes free; arena text is reclaimed by the next repack
+	hslot *h=&cli->hst[slot];
+
+	if (cli->hbucket)
+		yacli_hist_unlink(cli,slot);
+	yacli_hist_detach(cli,slot);
+	if (!h->ext)
+		cli->harenalive-=h->len+1;
+	else if (!--cli->hmapcnt) // nothing uses the file map anymore
+		yacli_hist_unmap(cli);
+	if (h->tnode!=-1) // its trie refs are stale now
+		cli->htrielive-=h->len;
+	h->id=0;
+	h->next=cli->hstfree;
+	cli->hstfree=slot;
+	cli->hstcnt--;
 } // }}}
 
-static inline int yacli_linelen(yacli *cli) { // {{{
-	int linelen;
+static inline int yacli_hist_rehash(yacli *cli) { // {{{
+	// rebuild dedup buckets (slots have moved or dedup is turned on), older duplicates are removed
+	int i,k,n=16;
 
-	if (!cli)
+	if (!cli->hdedup) {
+		if (cli->hbucket)
+			free(cli->hbucket);
+		cli->hbucket=NULL;
+		cli->hbucketn=0;
 		return 0;
+	}
 
-	linelen=cli->buflen-cli->bufpos;
-	if (linelen>yacli_dispspace(cli))
-		linelen=yacli_dispspace(cli)-1;
+	while (n<cli->hstcap)
+		n*=2;
+	if (n!=cli->hbucketn) {
+		int *t=realloc(cli->hbucket,n*sizeof *t);
 
-	return linelen;
+		if (!t)
+			return -1;
+		cli->hbucket=t;
+		cli->hbucketn=n;
+	}
+	for (i=0;i<n;i++)
+		cli->hbucket[i]=-1;
+
+	for (k=cli->hsttail;k!=-1;) { // newest first
+		hslot *h=&cli->hst[k];
+		const char *c=yacli_hist_get(cli,k,NULL);
+		int prev=h->prev;
+
+		h->hash=yacli_agg_hash(c,h->len);
+		h->hnext=-1;
+		if (yacli_hist_find(cli,c,h->len,h->hash)!=-1)
+			yacli_hist_remove(cli,k);
+		else
+			yacli_hist_link(cli,k);
+		k=prev;
+	}
+	return 0;
 } // }}}
 
-static inline int yacli_search_linelen(yacli *cli) { // {{{
-	int linelen;
+static inline void yacli_hist_drop(yacli *cli,int n) { // {{{
+	// evict n oldest commands
+	while (n-->0&&cli->hstcnt)
+		yacli_hist_remove(cli,cli->hsthead);
+} // }}}
 
-	if (!cli)
-		return 0;
+static inline void yacli_htrie_clear(yacli *cli) { // {{{
+	// drop prefix trie, history commands are indexed again on next prefix browsing
+	int i,k;
+
+	for (i=0;i<cli->htrien;i++)
+		if (cli->htrie[i].ref)
+			free(cli->htrie[i].ref);
+	cli->htrien=0;
+	cli->htrieref=0;
+	cli->htrielive=0;
+	cli->htrieend=0;
+	for (k=cli->hsthead;k!=-1;k=cli->hst[k].next)
+		cli->hst[k].tnode=-1;
+} // }}}
 
-	linelen=0;
-	if (cli->rcmd)
-		linelen=strlen(cli->rcmd);
-	if (linelen>yacli_search_dispspace(cli))
-		linelen=yacli_search_dispspace(cli)-1;
+static inline void yacli_hist_reset(yacli *cli) { // {{{
+	// all slots are free, history must be empty
+	int i;
 
-	return linelen;
+	for (i=0;i<cli->hstcap;i++) {
+		cli->hst[i].id=0;
+		cli->hst[i].next=i+1<cli->hstcap?i+1:-1;
+	}
+	cli->hstfree=0;
+	cli->hsthead=-1;
+	cli->hsttail=-1;
+	yacli_htrie_clear(cli); // slots are reused with other commands
 } // }}}
 
-static inline char yacli_begc(yacli *cli) { // {{{
-	char begc;
-
-	if (!cli)
+static inline int yacli_hist_alloc(yacli *cli) { // {{{
+	if (cli->hst)
 		return 0;
+	cli->hst=malloc(cli->hstcap*sizeof *cli->hst);
+	if (!cli->hst)
+		return -1;
+	yacli_hist_reset(cli);
+	return 0;
+} // }}}
 
-	begc=cli->bufpos?'$':' ';
+static inline int yacli_hist_repack(yacli *cli,int need) { // {{{
+	// make room for need more arena bytes, texts of evicted commands are dropped
+	// the new arena has at least as much free space as the live texts plus the slots walked, so the copy is paid by later adds
+	int ns=mymax(cli->harenasiz,2*(cli->harenalive+need)+cli->hstcnt);
+	char *t=malloc(ns);
+	int k,n=0;
 
-	return begc;
+	if (!t)
+		return -1;
+	for (k=cli->hsthead;k!=-1;k=cli->hst[k].next) {
+		hslot *h=&cli->hst[k];
+
+		if (h->ext)
+			continue;
+		memcpy(t+n,cli->harena+h->off,h->len+1);
+		h->off=n;
+		n+=h->len+1;
+	}
+	if (cli->harena)
+		free(cli->harena);
+	cli->harena=t;
+	cli->harenasiz=ns;
+	cli->harenalen=n;
+	return 0;
 } // }}}
 
-static inline char *yacli_endc(yacli *cli) { // {{{
-	char *endc="";
-	int linelen;
+static inline int yacli_hist_lock(yacli *cli) { // {{{
+	// lock history file for append; reopen it when another session has replaced it by compaction
+	// return 0 on success with the lock held, non-zero on error
+	for (;;) {
+		struct stat a,b;
+		int fd;
 
-	if (!cli)
-		return 0;
+		if (flock(cli->hfd,LOCK_EX))
+			return -1;
+		if (fstat(cli->hfd,&a)||stat(cli->hpath,&b)) {
+			flock(cli->hfd,LOCK_UN);
+			return -1;
+		}
+		if (a.st_ino==b.st_ino&&a.st_dev==b.st_dev) {
+			cli->hfsize=a.st_size; // other sessions append too
+			return 0;
+		}
+		fd=open(cli->hpath,O_RDWR|O_APPEND|O_CLOEXEC);
+		if (fd==-1) {
+			flock(cli->hfd,LOCK_UN);
+			return -1;
+		}
+		close(cli->hfd); // drops the lock on the old file
+		cli->hfd=fd;
+	}
+} // }}}
 
-	linelen=cli->buflen-cli->bufpos;
-	if (linelen>yacli_dispspace(cli))
-		endc="$";
+static inline int yacli_hist_compact(yacli *cli) { // {{{
+	// rewrite history file with its newest commands that fit in half of the size limit
+	// called with the lock held, so the file has the commands of all sessions; the lock goes away with the old file
+	size_t keep=cli->hfmax/2,from,done=0,beg=0,b;
+	char *buf,*tmp;
+	int fd;
+
+	from=cli->hfsize>keep?cli->hfsize-keep:0;
+	buf=malloc(cli->hfsize-from+1);
+	tmp=malloc(strlen(cli->hpath)+5);
+	if (!buf||!tmp) {
+		if (buf)
+			free(buf);
+		if (tmp)
+			free(tmp);
+		return -1;
+	}
+	while (done<cli->hfsize-from) {
+		ssize_t r=pread(cli->hfd,buf+done,cli->hfsize-from-done,from+done);
 
-	return endc;
-} // }}}
+		if (r<=0)
+			break;
+		done+=r;
+	}
+	if (from) { // first command may be cut
+		while (beg<done&&buf[beg]!='\n')
+			beg++;
+		if (beg<done)
+			beg++;
+	}
 
-static inline char *yacli_search_endc(yacli *cli) { // {{{
-	char *endc="";
-	int linelen;
+	sprintf(tmp,"%s.tmp",cli->hpath);
+	fd=open(tmp,O_WRONLY|O_CREAT|O_TRUNC|O_CLOEXEC,0600);
+	for (b=beg;fd!=-1&&b<done;) {
+		ssize_t w=write(fd,buf+b,done-b);
 
-	if (!cli)
-		return 0;
+		if (w<=0)
+			break;
+		b+=w;
+	}
+	free(buf);
+	if (fd==-1||b<done||close(fd)||rename(tmp,cli->hpath)) {
+		if (fd!=-1)
+			unlink(tmp);
+		free(tmp);
+		return -1;
+	}
+	free(tmp);
 
-	linelen=0;
-	if (cli->rcmd)
-		linelen=strlen(cli->rcmd);
-	if (linelen>yacli_search_dispspace(cli))
-		endc="$";
+	// the map of the old file stays valid after rename; other sessions reopen the file when they get the lock
+	fd=open(cli->hpath,O_RDWR|O_APPEND|O_CLOEXEC);
+	if (fd==-1)
+		return -1;
+	close(cli->hfd);
+	cli->hfd=fd;
+	cli->hfsize=done-beg;
+	return 0;
+} // }}}
 
-	return endc;
+static inline hshslot *yacli_hsh_slot(hshm *h,uint64_t n) { // {{{
+	return (hshslot *)(h+1)+(n&(h->nslot-1));
 } // }}}
 
-static inline int yacli_bufpos_shiftr(yacli *cli) { // {{{
-	if (!cli)
-		return 0;
+static inline char *yacli_hsh_text(hshm *h) { // {{{
+	return (char *)((hshslot *)(h+1)+h->nslot);
+} // }}}
 
-	if (cli->buflen-cli->bufpos<yacli_dispspace(cli)) // no right truncate or exact right end - do not shift
-		return 0;
+static inline void yacli_hsh_put(yacli *cli,const char *buf,int len) { // {{{
+	// lock free append: reserve sequence and text, fill the slot, publish with an even seq
+	hshm *h=cli->hsh;
+	hshslot *sl;
+	uint64_t n,o;
+	uint32_t p,l1;
 
-	if (cli->cursor-cli->bufpos>=yacli_dispspace(cli)-2) // shift is needed
-		return 1;
+	if ((uint32_t)len>h->tsiz/4) // too long for the text area
+		return;
+
+	n=__atomic_fetch_add(&h->seq,1,__ATOMIC_RELAXED);
+	o=__atomic_fetch_add(&h->toff,len,__ATOMIC_RELAXED);
+	sl=yacli_hsh_slot(h,n);
+	__atomic_store_n(&sl->seq,2*n+1,__ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__atomic_store_n(&sl->off,o,__ATOMIC_RELAXED);
+	__atomic_store_n(&sl->owner,cli->hshid,__ATOMIC_RELAXED);
+	__atomic_store_n(&sl->len,len,__ATOMIC_RELAXED);
+	p=o&(h->tsiz-1);
+	l1=mymin((uint32_t)len,h->tsiz-p);
+	memcpy(yacli_hsh_text(h)+p,buf,l1);
+	memcpy(yacli_hsh_text(h),buf+l1,len-l1);
+	__atomic_store_n(&sl->seq,2*n+2,__ATOMIC_RELEASE);
+} // }}}
 
+static inline int yacli_hist_new(yacli *cli,const char *buf,int len,unsigned hash) { // {{{
+	// store command text in a free slot as the newest command
+	hslot *h;
+	int slot;
+
+	if (cli->hstcnt==cli->hstcap)
+		yacli_hist_drop(cli,1);
+	if (cli->harenalen+len+1>cli->harenasiz&&yacli_hist_repack(cli,len+1))
+		return -1;
+
+	slot=cli->hstfree;
+	h=&cli->hst[slot];
+	cli->hstfree=h->next;
+	h->ext=NULL;
+	h->off=cli->harenalen;
+	h->len=len;
+	h->hash=hash;
+	h->tnode=-1;
+	memcpy(cli->harena+cli->harenalen,buf,len);
+	cli->harena[cli->harenalen+len]=0;
+	cli->harenalen+=len+1;
+	cli->harenalive+=len+1;
+	yacli_hist_append(cli,slot);
+	if (cli->hbucket)
+		yacli_hist_link(cli,slot);
+	cli->hstcnt++;
 	return 0;
 } // }}}
 
-static inline void yacli_search_prompt(yacli *cli) { // {{{
-	int promptlen=yacli_search_promptlen(cli);
-	int linelen=yacli_search_linelen(cli);
-	char *endc=yacli_search_endc(cli);
-	char *sbuf=cli->sbuf?cli->sbuf:"";
-	char *rcmd=cli->rcmd?cli->rcmd:"";
+static inline int yacli_hist_add(yacli *cli,const char *buf,int len,int own) { // {{{
+	// add command to history; own commands also go to history file and shared history
+	unsigned hash=0;
+	int k=-1;
 
-	yascreen_print(cli->s,"%s\r(i-search)'%s': %.*s%s\r\e[%dC",yascreen_clearln_s(cli->s),sbuf,linelen,rcmd,endc,promptlen-3);
-	yascreen_write(cli->s,"",0);
+	cli->hst_p=-1;
+
+	if (!len) // skip empty command
+		return 0;
+	if (cli->hstcnt) { // skip repeated command
+		int ll;
+		const char *last=yacli_hist_get(cli,cli->hsttail,&ll);
+
+		if (ll==len&&!memcmp(buf,last,len))
+			return 0;
+	}
+
+	if (yacli_hist_alloc(cli))
+		return -1;
+	if (cli->hbucket) {
+		hash=yacli_agg_hash(buf,len);
+		k=yacli_hist_find(cli,buf,len,hash);
+	}
+	if (k!=-1) { // older copy becomes the newest command, it keeps its slot and text
+		yacli_hist_detach(cli,k);
+		yacli_hist_append(cli,k);
+	} else if (yacli_hist_new(cli,buf,len,hash))
+		return -1;
+
+	if (own&&cli->hsh)
+		yacli_hsh_put(cli,buf,len);
+	if (own&&cli->hfd!=-1&&!yacli_hist_lock(cli)) { // single append to history file
+		struct iovec iov[2];
+
+		iov[0].iov_base=(void *)buf;
+		iov[0].iov_len=len;
+		iov[1].iov_base="\n";
+		iov[1].iov_len=1;
+		if (writev(cli->hfd,iov,2)==len+1)
+			cli->hfsize+=len+1;
+		if (!cli->hfmax||cli->hfsize<=cli->hfmax||yacli_hist_compact(cli))
+			flock(cli->hfd,LOCK_UN);
+	}
+	return 0;
 } // }}}
 
-static inline void yacli_prompt(yacli *cli) { // {{{
-	int promptlen;
-	int linelen;
-	char begc;
-	char *endc;
-	int curpos;
+static inline void yacli_hsh_pull(yacli *cli) { // {{{
+	// copy new commands of other sessions into local history
+	uint64_t head;
+	hshm *h;
 
-	if (!cli)
+	if (!cli->hsh)
 		return;
 
-	promptlen=yacli_promptlen(cli);
-	linelen=yacli_linelen(cli);
-	begc=yacli_begc(cli);
-	endc=yacli_endc(cli);
+	h=cli->hsh;
+	head=__atomic_load_n(&h->seq,__ATOMIC_ACQUIRE);
+	if (head-cli->hshseq>h->nslot) // missed ones are overwritten
+		cli->hshseq=head-h->nslot;
 
-	if (cli->state==IN_SEARCH) {
-		yacli_search_prompt(cli);
-		return;
-	} else if (cli->state==IN_MORE) {
-		yacli_more_prompt(cli);
-		return;
+	while (cli->hshseq<head) {
+		uint64_t n=cli->hshseq;
+		hshslot *sl=yacli_hsh_slot(h,n);
+		uint64_t v=__atomic_load_n(&sl->seq,__ATOMIC_ACQUIRE);
+		uint64_t off,owner;
+		uint32_t len,p,l1;
+		int empty=0;
+
+		if (v<2*n+2) // still being written, try again next time
+			break;
+		cli->hshseq++;
+		if (v>2*n+2) // overwritten by a newer entry
+			continue;
+
+		off=__atomic_load_n(&sl->off,__ATOMIC_RELAXED);
+		owner=__atomic_load_n(&sl->owner,__ATOMIC_RELAXED);
+		len=__atomic_load_n(&sl->len,__ATOMIC_RELAXED);
+		if (len>h->tsiz/4||yacli_buf_inc(&cli->hshbuf,&cli->hshbufsiz,&empty,len+1))
+			continue;
+		p=off&(h->tsiz-1);
+		l1=mymin(len,h->tsiz-p);
+		memcpy(cli->hshbuf,yacli_hsh_text(h)+p,l1);
+		memcpy(cli->hshbuf+l1,yacli_hsh_text(h),len-l1);
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		if (__atomic_load_n(&sl->seq,__ATOMIC_RELAXED)!=v) // slot was reused while copying
+			continue;
+		if (__atomic_load_n(&h->toff,__ATOMIC_RELAXED)-off>h->tsiz) // text was overwritten while copying
+			continue;
+		if (owner!=cli->hshid)
+			yacli_hist_add(cli,cli->hshbuf,len,0);
 	}
+} // }}}
 
-	cli->lines=0;
+inline int yacli_add_hist(yacli *cli,const char *buf) { // {{{
+	if (!cli)
+		return 0;
 
-	curpos=cli->cursor-cli->bufpos; // zero based in buffer
-	curpos+=promptlen;
+	yacli_hsh_pull(cli); // commands from other sessions go before this one
+	return yacli_hist_add(cli,buf,strlen(buf),1);
+} // }}}
 
-	yascreen_print(cli->s,"%s\r%s%s%s%c%.*s%s\r\e[%dC",yascreen_clearln_s(cli->s),cli->hostname,cli->modes?cli->modes:"",cli->level,begc,linelen,cli->buffer+cli->bufpos,endc,curpos);
-	cli->redraw=0;
-	yascreen_write(cli->s,"",0);
+static hshm *yacli_hsh_anon; // process wide shared history
+static int yacli_hsh_anonref; // sessions using yacli_hsh_anon
+static pthread_mutex_t yacli_hsh_mtx=PTHREAD_MUTEX_INITIALIZER; // protects yacli_hsh_anon
+
+static inline void yacli_hsh_detach(yacli *cli) { // {{{
+	if (!cli->hsh)
+		return;
+
+	if (cli->hshanon) {
+		pthread_mutex_lock(&yacli_hsh_mtx);
+		if (!--yacli_hsh_anonref) {
+			munmap(yacli_hsh_anon,cli->hshsiz);
+			yacli_hsh_anon=NULL;
+		}
+		pthread_mutex_unlock(&yacli_hsh_mtx);
+	} else
+		munmap(cli->hsh,cli->hshsiz);
+	cli->hsh=NULL;
+	cli->hshsiz=0;
+	cli->hshanon=0;
 } // }}}
 
-inline void yacli_message(yacli *cli,const char *line) { // {{{
-	const char *p,*q;
+inline int yacli_set_hist_shared(yacli *cli,int on,const char *name) { // {{{
+	size_t siz=sizeof(hshm)+HSH_SLOTS*sizeof(hshslot)+HSH_TEXT;
+	hshm *h;
 
 	if (!cli)
-		return;
-	if (!line)
-		return;
+		return -1;
 
-	if (!cli->incmdcb)
-		yascreen_print(cli->s,"%s\r",yascreen_clearln_s(cli->s)); // clear prompt line
-	p=line;
-	while (*p) {
-		q=p;
-		while (*q&&*q!='\n')
-			q++;
-		if (q-p)
-			yascreen_print(cli->s,"%.*s",(int)(q-p),p);
-		if (*q=='\n') {
-			yascreen_print(cli->s,"\r\n");
-			p=q+1;
-		} else {
-			yascreen_print(cli->s,"\n"); // append new line, if it was missing
-			p=q;
+	yacli_hsh_detach(cli);
+	if (!on)
+		return 0;
+
+	if (!name) { // shared by the sessions of this process
+		pthread_mutex_lock(&yacli_hsh_mtx);
+		if (!yacli_hsh_anon) {
+			h=mmap(NULL,siz,PROT_READ|PROT_WRITE,MAP_SHARED|MAP_ANONYMOUS,-1,0);
+			if (h!=MAP_FAILED) {
+				h->nslot=HSH_SLOTS;
+				h->tsiz=HSH_TEXT;
+				h->magic=HSH_MAGIC;
+				yacli_hsh_anon=h;
+			}
+		}
+		if (yacli_hsh_anon)
+			yacli_hsh_anonref++;
+		h=yacli_hsh_anon;
+		pthread_mutex_unlock(&yacli_hsh_mtx);
+		if (!h)
+			return -1;
+		cli->hshanon=1;
+	} else { // shared with cooperating processes
+		uint64_t m=0;
+		struct stat st;
+		int fd;
+
+		fd=shm_open(name,O_RDWR|O_CREAT|O_CLOEXEC,0600);
+		if (fd==-1)
+			return -1;
+		if (fstat(fd,&st)||(!st.st_size&&ftruncate(fd,siz))||(!st.st_size&&fstat(fd,&st))||(size_t)st.st_size<sizeof(hshm)) {
+			close(fd);
+			return -1;
+		}
+		siz=st.st_size;
+		h=mmap(NULL,siz,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+		close(fd);
+		if (h==MAP_FAILED)
+			return -1;
+		if (__atomic_compare_exchange_n(&h->magic,&m,HSH_INIT,0,__ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE)) { // we are first
+			h->nslot=HSH_SLOTS;
+			h->tsiz=HSH_TEXT;
+			__atomic_store_n(&h->magic,HSH_MAGIC,__ATOMIC_RELEASE);
+		}
+		while (__atomic_load_n(&h->magic,__ATOMIC_ACQUIRE)==HSH_INIT) // another process initializes it
+			sched_yield();
+		if (h->magic!=HSH_MAGIC||!h->nslot||(h->nslot&(h->nslot-1))||!h->tsiz||(h->tsiz&(h->tsiz-1))||sizeof(hshm)+(size_t)h->nslot*sizeof(hshslot)+h->tsiz>siz) {
+			munmap(h,siz);
+			return -1;
 		}
 	}
-	if (!cli->incmdcb)
-		yacli_prompt(cli);
+
+	cli->hsh=h;
+	cli->hshsiz=siz;
+	cli->hshid=((uint64_t)getpid()<<32)|(uint32_t)(__atomic_fetch_add(&h->owners,1,__ATOMIC_RELAXED)+1);
+	cli->hshseq=0; // start with what is already there
+	yacli_hsh_pull(cli);
+	return 0;
+} // }}}
+
+inline int yacli_set_hist_size(yacli *cli,int n) { // {{{
+	hslot *t;
+	int i,k;
+
+	if (!cli)
+		return -1;
+	if (n<=0)
+		n=HIST_SIZE;
+
+	t=malloc(n*sizeof *t);
+	if (!t)
+		return -1;
+	yacli_hist_drop(cli,cli->hstcnt-n); // keep newest commands
+	for (i=0,k=cli->hsthead;k!=-1;i++,k=cli->hst[k].next) { // in history order, free slots follow
+		t[i]=cli->hst[k];
+		t[i].prev=i-1;
+		t[i].next=i+1<cli->hstcnt?i+1:-1;
+	}
+	for (;i<n;i++) {
+		t[i].id=0;
+		t[i].next=i+1<n?i+1:-1;
+	}
+	if (cli->hst)
+		free(cli->hst);
+	cli->hst=t;
+	cli->hstcap=n;
+	cli->hsthead=cli->hstcnt?0:-1;
+	cli->hsttail=cli->hstcnt-1;
+	cli->hstfree=cli->hstcnt<n?cli->hstcnt:-1;
+	cli->hst_p=-1;
+	yacli_htrie_clear(cli); // slots have moved
+	return yacli_hist_rehash(cli);
 } // }}}
 
-static inline void yacli_eof(yacli *cli) { // {{{
+inline void yacli_set_hist_prefix(yacli *cli,int on) { // {{{
 	if (!cli)
 		return;
 
-	cli->retcode=YACLI_EOF;
+	cli->hprefix=!!on;
 } // }}}
 
-inline void yacli_exit(yacli *cli) { // {{{
+inline int yacli_set_hist_dedup(yacli *cli,int on) { // {{{
 	if (!cli)
-		return;
+		return -1;
 
-	yacli_eof(cli);
+	cli->hdedup=!!on;
+	if (on&&yacli_hist_alloc(cli))
+		return -1;
+	return yacli_hist_rehash(cli);
 } // }}}
 
-inline int yacli_add_hist(yacli *cli,const char *buf) { // {{{
-	history *h;
+inline int yacli_set_hist_file(yacli *cli,const char *path,size_t maxsize) { // {{{
+	struct stat st;
+	size_t pos;
+	int n=0,slot;
 
 	if (!cli)
-		return 0;
-
-	cli->hst_p=NULL;
+		return -1;
 
-	if (!strlen(buf)) // skip empty command
+	// forget current history and file
+	yacli_hist_drop(cli,cli->hstcnt);
+	yacli_hist_unmap(cli);
+	if (cli->hst)
+		yacli_hist_reset(cli);
+	cli->hst_p=-1;
+	if (cli->hfd!=-1)
+		close(cli->hfd);
+	cli->hfd=-1;
+	if (cli->hpath)
+		free(cli->hpath);
+	cli->hpath=NULL;
+	if (!path)
 		return 0;
-	if (cli->hst&&!strcmp(buf,cli->hst->prev->command)) // skip repeated command
-		return 0;
-
-	h=calloc(1,sizeof *h);
 
-	if (!h)
+	if (yacli_hist_alloc(cli))
 		return -1;
-
-	h->command=strdup(buf);
-	if (!h->command) {
-		free(h);
+	cli->hpath=strdup(path);
+	if (!cli->hpath)
+		return -1;
+	cli->hfd=open(path,O_RDWR|O_CREAT|O_APPEND|O_CLOEXEC,0600);
+	if (cli->hfd==-1||fstat(cli->hfd,&st)) {
+		if (cli->hfd!=-1)
+			close(cli->hfd);
+		cli->hfd=-1;
+		free(cli->hpath);
+		cli->hpath=NULL;
 		return -1;
 	}
+	cli->hfmax=maxsize;
+	cli->hfsize=st.st_size;
+	if (!st.st_size)
+		return 0;
 
-	if (!cli->hst) {
-		cli->hst=h;
-		h->prev=h->next=h;
-	} else {
-		h->next=cli->hst;
-		h->prev=cli->hst->prev;
-		cli->hst->prev=h;
-		h->prev->next=h;
+	cli->hmap=mmap(NULL,st.st_size,PROT_READ,MAP_PRIVATE,cli->hfd,0);
+	if (cli->hmap==MAP_FAILED) { // keep appending, but start with empty history
+		cli->hmap=NULL;
+		return 0;
+	}
+	cli->hmapsiz=st.st_size;
+
+	if (cli->hmap[st.st_size-1]!='\n'&&write(cli->hfd,"\n",1)==1) // finish partially written last command
+		cli->hfsize++;
+
+	// take newest commands from the end, texts stay in the map
+	for (pos=st.st_size;pos>0&&n<cli->hstcap;) {
+		size_t e=pos,b;
+
+		if (cli->hmap[e-1]=='\n')
+			e--;
+		for (b=e;b>0&&cli->hmap[b-1]!='\n';b--)
+			;
+		if (e>b) { // skip empty lines, older commands go before the ones taken so far
+			hslot *h=&cli->hst[cli->hstfree];
+
+			slot=cli->hstfree;
+			cli->hstfree=h->next;
+			h->ext=cli->hmap+b;
+			h->off=0;
+			h->len=e-b;
+			h->tnode=-1;
+			h->prev=-1;
+			h->next=cli->hsthead;
+			if (cli->hsthead!=-1)
+				cli->hst[cli->hsthead].prev=slot;
+			else
+				cli->hsttail=slot;
+			cli->hsthead=slot;
+			n++;
+		}
+		pos=b;
 	}
+	for (slot=cli->hsthead;slot!=-1;slot=cli->hst[slot].next) // ids grow from oldest
+		cli->hst[slot].id=++cli->hstseq;
+	cli->hstcnt=n;
+	cli->hmapcnt=n;
+	if (!n)
+		yacli_hist_unmap(cli);
+	yacli_hist_rehash(cli);
+	if (cli->hfmax&&cli->hfsize>cli->hfmax&&!yacli_hist_lock(cli)&&yacli_hist_compact(cli))
+		flock(cli->hfd,LOCK_UN);
 	return 0;
 } // }}}
 
@@ -1266,14 +4387,14 @@ static inline void yacli_moveleftw(yacli *cli) { // {{{
 		return;
 
 	if (cli->cursor) {
-		if (cli->buffer[cli->cursor]!=' '&&cli->buffer[cli->cursor-1]==' ') // if we are at word begin, step left
+		if (yacli_bufc(cli,cli->cursor)!=' '&&yacli_bufc(cli,cli->cursor-1)==' ') // if we are at word begin, step left
 			cli->cursor--;
-		while (cli->cursor&&cli->buffer[cli->cursor]==' ') // skip space
+		while (cli->cursor&&yacli_bufc(cli,cli->cursor)==' ') // skip space
 			cli->cursor--;
-		if (cli->cursor&&cli->buffer[cli->cursor]!=' ') { // skip word
-			while (cli->cursor&&cli->buffer[cli->cursor]!=' ')
+		if (cli->cursor&&yacli_bufc(cli,cli->cursor)!=' ') { // skip word
+			while (cli->cursor&&yacli_bufc(cli,cli->cursor)!=' ')
 				cli->cursor--;
-			if (cli->buffer[cli->cursor]==' ')
+			if (yacli_bufc(cli,cli->cursor)==' ')
 				cli->cursor++; // step right at the beginning of the word
 		}
 		if (cli->cursor<cli->bufpos)
@@ -1289,13 +4410,13 @@ static inline void yacli_moverightw(yacli *cli) { // {{{
 	if (cli->cursor<cli->buflen) {
 		int shiftr=yacli_bufpos_shiftr(cli);
 
-		while (cli->cursor<cli->buflen&&cli->buffer[cli->cursor]==' ') { // skip space
+		while (cli->cursor<cli->buflen&&yacli_bufc(cli,cli->cursor)==' ') { // skip space
 			cli->cursor++;
 			if (shiftr)
 				cli->bufpos++;
 			shiftr=yacli_bufpos_shiftr(cli);
 		}
-		while (cli->cursor<cli->buflen&&cli->buffer[cli->cursor]!=' ') { // skip word
+		while (cli->cursor<cli->buflen&&yacli_bufc(cli,cli->cursor)!=' ') { // skip word
 			cli->cursor++;
 			if (shiftr)
 				cli->bufpos++;
@@ -1341,7 +4462,8 @@ static inline void yacli_del(yacli *cli) { // {{{
 		return;
 
 	if (cli->cursor<cli->buflen) {
-		memmove(cli->buffer+cli->cursor,cli->buffer+cli->cursor+1,cli->buflen-cli->cursor-1);
+		yacli_buf_gap(cli,cli->cursor,0); // char after the gap joins it
+		cli->gap++;
 		cli->buflen--;
 		cli->redraw=1;
 	}
@@ -1352,7 +4474,9 @@ static inline void yacli_bsp(yacli *cli) { // {{{
 		return;
 
 	if (cli->cursor) {
-		memmove(cli->buffer+cli->cursor-1,cli->buffer+cli->cursor,cli->buflen-cli->cursor);
+		yacli_buf_gap(cli,cli->cursor,0); // char before the gap joins it
+		cli->gappos--;
+		cli->gap++;
 		cli->buflen--;
 		cli->cursor--;
 		if (cli->bufpos>cli->cursor)
@@ -1368,10 +4492,10 @@ static inline void yacli_delword(yacli *cli) { // {{{
 	if (cli->cursor>=cli->buflen) // nothing to delete
 		return;
 
-	if (cli->buffer[cli->cursor]==' ')
-		while (cli->buffer[cli->cursor]==' '&&cli->cursor<cli->buflen)
+	if (yacli_bufc(cli,cli->cursor)==' ')
+		while (cli->cursor<cli->buflen&&yacli_bufc(cli,cli->cursor)==' ')
 			yacli_del(cli);
-	while (cli->buffer[cli->cursor]!=' '&&cli->cursor<cli->buflen)
+	while (cli->cursor<cli->buflen&&yacli_bufc(cli,cli->cursor)!=' ')
 		yacli_del(cli);
 } // }}}
 
@@ -1382,10 +4506,10 @@ static inline void yacli_delprevword(yacli *cli) { // {{{
 	if (!cli->cursor) // nothing to delete
 		return;
 
-	if (cli->cursor>0&&cli->buffer[cli->cursor-1]==' ')
-		while (cli->buffer[cli->cursor-1]==' '&&cli->cursor)
+	if (cli->cursor>0&&yacli_bufc(cli,cli->cursor-1)==' ')
+		while (cli->cursor&&yacli_bufc(cli,cli->cursor-1)==' ')
 			yacli_bsp(cli);
-	while (cli->cursor&&cli->buffer[cli->cursor-1]!=' ')
+	while (cli->cursor&&yacli_bufc(cli,cli->cursor-1)!=' ')
 		yacli_bsp(cli);
 } // }}}
 
@@ -1394,86 +4518,249 @@ static inline void yacli_deltoend(yacli *cli) { // {{{
 		return;
 
 	if (cli->cursor<cli->buflen) {
+		if (cli->gap&&cli->gappos>cli->cursor) { // text up to the gap is dropped into it
+			cli->gap+=cli->gappos-cli->cursor;
+			cli->gappos=cli->cursor;
+		}
 		cli->buflen=cli->cursor;
 		cli->redraw=1;
 	}
 } // }}}
 
-static inline void yacli_setbuf(yacli *cli,const char *buf) { // {{{
-	int len;
-	int add;
+static inline void yacli_setbufl(yacli *cli,const char *buf,int len) { // {{{
+	int empty=0;
 
 	if (!cli)
 		return;
 
-	len=strlen(buf);
-	add=len+1-cli->bufsiz; // add 1 for zero term by strcpy
-
-	if (yacli_buf_inc(&cli->buffer,&cli->bufsiz,&cli->buflen,add)) // error in malloc
+	cli->gap=0;
+	if (yacli_buf_inc(&cli->buffer,&cli->bufsiz,&empty,len+1)) // add 1 for zero term; error in malloc
 		return;
 
-	strncpy(cli->buffer,buf,cli->bufsiz);
+	memcpy(cli->buffer,buf,len);
+	cli->buffer[len]=0;
 	cli->buflen=len;
 	cli->cursor=len;
+	cli->bufpos=mymax(0,len-yacli_dispspace(cli)+1); // view of the previous line may be past the end
 	cli->redraw=1;
 } // }}}
 
+static inline void yacli_setbuf(yacli *cli,const char *buf) { // {{{
+	yacli_setbufl(cli,buf,strlen(buf));
+} // }}}
+
+static inline int yacli_htrie_node(yacli *cli,unsigned char ch) { // {{{
+	// new trie node without children and refs, -1 on error
+	htnode *t;
+	int k;
+
+	if (cli->htrien==cli->htriesiz) {
+		int ns=mymax(cli->htriesiz*2,BUFFER_STEP);
+		htnode *n=realloc(cli->htrie,ns*sizeof *n);
+
+		if (!n)
+			return -1;
+		cli->htrie=n;
+		cli->htriesiz=ns;
+	}
+	k=cli->htrien++;
+	t=&cli->htrie[k];
+	t->ref=NULL;
+	t->last=0;
+	t->child=-1;
+	t->sib=-1;
+	t->n=0;
+	t->siz=0;
+	t->ch=ch;
+	return k;
+} // }}}
+
+static inline int yacli_htrie_child(yacli *cli,int node,unsigned char ch,int add) { // {{{
+	// child of node for the next byte, new one is added with add; -1 when there is none or on error
+	int k;
+
+	for (k=cli->htrie[node].child;k!=-1;k=cli->htrie[k].sib)
+		if (cli->htrie[k].ch==ch)
+			return k;
+	if (!add||(k=yacli_htrie_node(cli,ch))==-1)
+		return -1;
+	cli->htrie[k].sib=cli->htrie[node].child;
+	cli->htrie[node].child=k;
+	return k;
+} // }}}
+
+static inline int yacli_htrie_add(yacli *cli,int slot) { // {{{
+	// add command to the nodes of all its prefixes; it goes last, as it is the newest there
+	hslot *h=&cli->hst[slot];
+	const char *c=yacli_hist_get(cli,slot,NULL);
+	int i,node=0;
+
+	for (i=0;i<h->len;i++) {
+		htnode *t;
+
+		node=yacli_htrie_child(cli,node,c[i],1);
+		if (node==-1)
+			return -1;
+		t=&cli->htrie[node];
+		if (t->n==t->siz) {
+			int ns=t->siz?t->siz*2:4;
+			hidxref *r=realloc(t->ref,ns*sizeof *r);
+
+			if (!r)
+				return -1;
+			t->ref=r;
+			t->siz=ns;
+		}
+		t->ref[t->n].id=h->id;
+		t->ref[t->n].slot=slot;
+		t->n++;
+	}
+	cli->htrie[node].last=h->id;
+	h->tnode=node;
+	cli->htrieref+=h->len;
+	cli->htrielive+=h->len;
+	return 0;
+} // }}}
+
+static inline int yacli_htrie_sync(yacli *cli) { // {{{
+	// index commands added since last sync, they are the newest; start over when most refs are stale
+	int k;
+
+	if (cli->htrieref>2*cli->htrielive+BUFFER_STEP)
+		yacli_htrie_clear(cli);
+	if (!cli->htrien&&yacli_htrie_node(cli,0)==-1) // root
+		return -1;
+
+	for (k=cli->hsttail;k!=-1&&cli->hst[k].id>cli->htrieend;k=cli->hst[k].prev)
+		;
+	for (k=k==-1?cli->hsthead:cli->hst[k].next;k!=-1;k=cli->hst[k].next)
+		if (yacli_htrie_add(cli,k)) {
+			yacli_htrie_clear(cli);
+			return -1;
+		}
+	cli->htrieend=cli->hstseq;
+	return 0;
+} // }}}
+
+static inline int yacli_hist_prefix(yacli *cli,const char *pfx,int plen) { // {{{
+	// start browsing commands that start with pfx, return -1 when there are none
+	int i,node=0;
+
+	cli->hpfxnode=-1;
+	if (yacli_htrie_sync(cli))
+		return -1;
+	for (i=0;i<plen&&node!=-1;i++)
+		node=yacli_htrie_child(cli,node,pfx[i],0);
+	if (node==-1)
+		return -1;
+	cli->hpfxnode=node;
+	cli->hpfxlen=plen;
+	cli->hpfx_p=cli->htrie[node].n; // before the newest
+	return 0;
+} // }}}
+
+static inline int yacli_hist_pfxstep(yacli *cli,int dir) { // {{{
+	// move to next older (dir -1) or newer (dir 1) prefix candidate; return its slot, or -1 and stay when there is none
+	// refs are in id order, so stale and repeated ones are only skipped and each step costs their count
+	htnode *t=&cli->htrie[cli->hpfxnode];
+	int i;
+
+	for (i=cli->hpfx_p+dir;i>=0&&i<t->n;i+=dir) {
+		hidxref *r=&t->ref[i];
+		hslot *h=&cli->hst[r->slot];
+
+		if (h->id!=r->id) // evicted or repeated later
+			continue;
+		if (cli->htrie[h->tnode].last!=r->id) // newer copy of the same text
+			continue;
+		if (h->len==cli->hpfxlen) // same as typed text
+			continue;
+		cli->hpfx_p=i;
+		return r->slot;
+	}
+	return -1;
+} // }}}
+
 static inline void yacli_buf_zeroterm(yacli *cli) { // {{{
 	if (!cli)
 		return;
 
+	yacli_buf_flat(cli);
 	if (yacli_buf_inc(&cli->buffer,&cli->bufsiz,&cli->buflen,1)) // error in malloc
 		return;
 	cli->buffer[cli->buflen]=0; // zero terminate the buffer
 } // }}}
 
 static inline void yacli_up(yacli *cli) { // {{{
+	const char *c;
+	int len,k;
+
 	if (!cli)
 		return;
 
-	if (!cli->hst_p&&!cli->hst) // no history
-		return;
-	if (!cli->hst_p) {
+	if (cli->hst_p==-1) {
+		yacli_hsh_pull(cli); // start browsing with commands from other sessions
+		yacli_buf_flat(cli);
+		cli->hpfxnode=-1;
+		if (cli->hprefix&&cli->buflen&&yacli_hist_prefix(cli,cli->buffer,cli->buflen)) // keep typed text when nothing matches
+			return;
+	}
+	if (cli->hpfxnode!=-1) { // only commands starting with the typed text
+		k=yacli_hist_pfxstep(cli,-1);
+		if (k==-1)
+			return;
+	} else {
+		k=cli->hst_p==-1?cli->hsttail:cli->hst[cli->hst_p].prev;
+		if (k==-1) // no history or limit history rollover
+			return;
+	}
+	if (cli->hst_p==-1) {
 		yacli_buf_zeroterm(cli); // zero terminate the buffer
 		if (cli->savbuf) // free old saved buffer
 			free(cli->savbuf);
 		cli->savbuf=strdup(cli->buffer); // save current buffer
-		cli->hst_p=cli->hst; // start with last history command
-		cli->hst_p=cli->hst_p->prev;
-		yacli_setbuf(cli,cli->hst_p->command);
-	} else { // we are already somewhere in history
-		if (cli->hst_p==cli->hst) // limit history rollover
-			return;
-		cli->hst_p=cli->hst_p->prev;
-		yacli_setbuf(cli,cli->hst_p->command);
 	}
+	cli->hst_p=k;
+	c=yacli_hist_get(cli,cli->hst_p,&len);
+	yacli_setbufl(cli,c,len);
 } // }}}
 
 static inline void yacli_down(yacli *cli) { // {{{
+	const char *c;
+	int len,k;
+
 	if (!cli)
 		return;
 
-	if (!cli->hst_p) // do not allow history rollover
+	if (cli->hst_p==-1) // do not allow history rollover
 		return;
-	cli->hst_p=cli->hst_p->next;
-	if (cli->hst_p==cli->hst) { // restore previously saved command
-		cli->hst_p=NULL;
-		yacli_setbuf(cli,cli->savbuf);
-		free(cli->savbuf);
+	if (cli->hpfxnode!=-1) // only commands starting with the typed text
+		k=yacli_hist_pfxstep(cli,1);
+	else
+		k=cli->hst[cli->hst_p].next;
+	cli->hst_p=k;
+	if (k==-1) { // restore previously saved command
+		yacli_setbuf(cli,cli->savbuf?cli->savbuf:"");
+		if (cli->savbuf)
+			free(cli->savbuf);
 		cli->savbuf=NULL;
 		return;
 	}
-	yacli_setbuf(cli,cli->hst_p->command);
+	c=yacli_hist_get(cli,cli->hst_p,&len);
+	yacli_setbufl(cli,c,len);
 } // }}}
 
 static inline void yacli_start_search(yacli *cli) { // {{{
 	if (!cli)
 		return;
 
+	yacli_hsh_pull(cli); // commands from other sessions are searched too
 	cli->state=IN_SEARCH;
+	cli->slen=0; // keep sbuf allocation for next searches
 	if (cli->sbuf)
-		free(cli->sbuf);
-	cli->sbuf=NULL;
+		cli->sbuf[0]=0;
+	cli->scandn=0;
+	cli->rpos=0;
 	cli->redraw=1;
 } // }}}
 
@@ -1482,62 +4769,78 @@ static inline void yacli_end_search(yacli *cli) { // {{{
 		return;
 
 	cli->state=IN_NORM;
+	cli->slen=0;
 	if (cli->sbuf)
-		free(cli->sbuf);
-	cli->sbuf=NULL;
+		cli->sbuf[0]=0;
+	cli->scandn=0;
 	cli->redraw=1;
 	if (cli->rcmd)
-		yacli_setbuf(cli,cli->rcmd);
+		yacli_setbufl(cli,cli->rcmd,cli->rcmdlen);
+	cli->rcmd=NULL;
+} // }}}
+
+static inline void yacli_search_set(yacli *cli) { // {{{
+	// show candidate at cursor
 	cli->rcmd=NULL;
+	if (cli->rpos<cli->scandn)
+		cli->rcmd=yacli_hist_get(cli,cli->scand[cli->rpos],&cli->rcmdlen);
 } // }}}
 
-static inline void yacli_find_first(yacli *cli,int skip) { // {{{
-	int sl;
+static inline void yacli_find_first(yacli *cli) { // {{{
+	// collect all matching commands, newest first
+	int k;
 
 	if (!cli)
 		return;
 
-	sl=cli->sbuf?strlen(cli->sbuf):0;
+	cli->scandn=0;
+	cli->rpos=0;
+	if (cli->slen&&cli->scandsiz<cli->hstcnt) {
+		int *t=realloc(cli->scand,cli->hstcnt*sizeof *t);
 
-	cli->rcmd=NULL;
-	if (cli->hst) { // find most recent matching command
-		int rpos=0;
-		history *h;
-
-		h=cli->hst->prev;
-		do {
-			if (sl&&strstr(h->command,cli->sbuf)) {
-				cli->rcmd=h->command; // save last found command
-				if (!skip) { // if we do not skip, use it
-					rpos++;
-					break;
-				} else {
-					skip--; // try to find another
-					rpos++;
-				}
-			}
+		if (t) {
+			cli->scand=t;
+			cli->scandsiz=cli->hstcnt;
+		}
+	}
+	for (k=cli->hsttail;cli->slen&&k!=-1&&cli->scandn<cli->scandsiz;k=cli->hst[k].prev) {
+		int len;
+		const char *c=yacli_hist_get(cli,k,&len);
 
-			h=h->prev;
-		} while (h!=cli->hst->prev);
-		rpos--;
-		if (cli->rcmd)
-			cli->rpos=rpos;
+		if (memmem(c,len,cli->sbuf,cli->slen))
+			cli->scand[cli->scandn++]=k;
 	}
+	yacli_search_set(cli);
 } // }}}
 
-static inline void yacli_search_up(yacli *cli) { // {{{
-	int rpos;
+static inline void yacli_find_narrow(yacli *cli) { // {{{
+	// search text was extended, only previous candidates can still match
+	int i,n=0;
 
 	if (!cli)
 		return;
 
-	rpos=cli->rpos;
+	for (i=0;i<cli->scandn;i++) {
+		int len;
+		const char *c=yacli_hist_get(cli,cli->scand[i],&len);
+
+		if (memmem(c,len,cli->sbuf,cli->slen))
+			cli->scand[n++]=cli->scand[i];
+	}
+	cli->scandn=n;
+	cli->rpos=0;
+	yacli_search_set(cli);
+} // }}}
 
-	cli->rpos++;
-	yacli_find_first(cli,cli->rpos);
+static inline void yacli_search_up(yacli *cli) { // {{{
+	if (!cli)
+		return;
 
-	if (rpos!=cli->rpos) // have found one more
+	if (cli->rpos+1<cli->scandn) { // have one more
+		cli->rpos++;
+		yacli_search_set(cli);
 		cli->redraw=1;
+	}
 } // }}}
 
 static inline void yacli_search_down(yacli *cli) { // {{{
@@ -1546,7 +4849,7 @@ static inline void yacli_search_down(yacli *cli) { // {{{
 
 	if (cli->rpos) {
 		cli->rpos--;
-		yacli_find_first(cli,cli->rpos);
+		yacli_search_set(cli);
 		cli->redraw=1;
 	}
 } // }}}
@@ -1555,53 +4858,36 @@ static inline void yacli_search_bsp(yacli *cli) { // {{{
 	if (!cli)
 		return;
 
-	if (!cli->sbuf)
-		return;
-	if (strlen(cli->sbuf)) {
-		cli->sbuf[strlen(cli->sbuf)-1]=0;
+	if (cli->slen) {
+		cli->sbuf[--cli->slen]=0;
 		cli->redraw=1;
 
-		// now find appropriate command
-		yacli_find_first(cli,0);
+		// shorter text matches more, start over
+		yacli_find_first(cli);
 	}
 } // }}}
 
 static inline void yacli_add_search(yacli *cli,unsigned char ch) { // {{{
-	int l;
-
 	if (!cli)
 		return;
 
-	if (!cli->sbuf) {
-		cli->sbuf=malloc(2);
-		if (!cli->sbuf)
-			return;
-		cli->sbuf[0]=0;
-	} else {
-		char *t=cli->sbuf;
-		size_t sz=strlen(t)+2;
-
-		cli->sbuf=malloc(sz);
-		if (!cli->sbuf) {
-			cli->sbuf=t;
-			return;
-		}
-		strncpy(cli->sbuf,t,sz);
-		free(t);
-	}
-	l=strlen(cli->sbuf);
-	cli->sbuf[l]=ch;
-	cli->sbuf[l+1]=0;
+	if (yacli_buf_inc(&cli->sbuf,&cli->ssiz,&cli->slen,2)) // char and zero term
+		return;
+	cli->sbuf[cli->slen++]=ch;
+	cli->sbuf[cli->slen]=0;
 	cli->redraw=1;
 
-	// now find appropriate command
-	yacli_find_first(cli,0);
+	if (cli->slen==1) // empty text matches nothing, so there are no candidates yet
+		yacli_find_first(cli);
+	else
+		yacli_find_narrow(cli);
 } // }}}
 
 static inline void yacli_delall(yacli *cli) { // {{{
 	if (!cli)
 		return;
 
+	cli->gap=0;
 	if (cli->buflen||cli->bufpos||cli->cursor) {
 		cli->buflen=0;
 		cli->bufpos=0;
@@ -1616,13 +4902,16 @@ static inline void yacli_ctrl_c(yacli *cli) { // {{{
 		return;
 
 	yacli_delall(cli);
+	if (cli->incmdcb||cli->state==IN_MORE||cli->opipe) // cancel output of the running command
+		yacli_outdone_set(cli,1);
 	cli->redraw=1; // always redraw after ^C
+	cli->scrok=0;
 	yascreen_puts(cli->s,"^C\r\n");
 	if (cli->savbuf) { // kill last saved command
 		free(cli->savbuf);
 		cli->savbuf=NULL;
 	}
-	cli->hst_p=NULL; // reset history position
+	cli->hst_p=-1; // reset history position
 	yascreen_puts(cli->s,"");
 } // }}}
 
@@ -1634,6 +4923,7 @@ static inline void yacli_ctrl_d(yacli *cli) { // {{{
 		yacli_del(cli);
 	else {
 		yacli_eof(cli);
+		cli->scrok=0;
 		yascreen_puts(cli->s,"\r\n"); // keep consistent with command that caused exit, because enter prints new line
 		yascreen_write(cli->s,"",0);
 	}
@@ -1643,15 +4933,36 @@ static inline void yacli_insert(yacli *cli,char ch) { // {{{
 	if (!cli)
 		return;
 
-	if (yacli_buf_inc(&cli->buffer,&cli->bufsiz,&cli->buflen,1)) // error in malloc
+	if (yacli_buf_gap(cli,cli->cursor,1)) // error in malloc
 		return;
-	memmove(cli->buffer+cli->cursor+1,cli->buffer+cli->cursor,cli->buflen-cli->cursor);
+	cli->buffer[cli->gappos++]=ch;
+	cli->gap--;
 	cli->buflen++;
-	cli->buffer[cli->cursor]=ch;
 	cli->redraw=1;
 	yacli_moveright(cli);
 } // }}}
 
+static inline void yacli_insertn(yacli *cli,const char *s,int n) { // {{{
+	int d,p;
+
+	if (!cli||n<=0)
+		return;
+
+	if (yacli_buf_gap(cli,cli->cursor,n)) // error in malloc
+		return;
+	memcpy(cli->buffer+cli->gappos,s,n);
+	cli->gappos+=n;
+	cli->gap-=n;
+	cli->buflen+=n;
+	cli->cursor+=n;
+	// scroll like moving right n times
+	d=yacli_dispspace(cli);
+	p=mymin(cli->cursor-d+2,cli->buflen-d+1);
+	if (p>cli->bufpos)
+		cli->bufpos=p;
+	cli->redraw=1;
+} // }}}
+
 inline void yacli_winch(yacli *cli) { // {{{
 	if (!cli)
 		return;
@@ -1665,6 +4976,7 @@ static inline void yacli_clear(yacli *cli) { // {{{
 
 	yascreen_clear(cli->s);
 	yacli_winch(cli);
+	cli->scrok=0;
 	cli->redraw=1;
 } // }}}
 
@@ -1692,6 +5004,15 @@ static inline void debugstate(yacli_in_state os __attribute__((unused)),yacli_in
 		case IN_SEARCH:
 			ostate="IN_SEARCH";
 			break;
+		case IN_ESC:
+			ostate="IN_ESC";
+			break;
+		case IN_PASTE:
+			ostate="IN_PASTE";
+			break;
+		case IN_OUTPUT:
+			ostate="IN_OUTPUT";
+			break;
 	}
 	switch (ns) {
 		case IN_MORE:
@@ -1706,6 +5027,15 @@ static inline void debugstate(yacli_in_state os __attribute__((unused)),yacli_in
 		case IN_SEARCH:
 			nstate="IN_SEARCH";
 			break;
+		case IN_ESC:
+			nstate="IN_ESC";
+			break;
+		case IN_PASTE:
+			nstate="IN_PASTE";
+			break;
+		case IN_OUTPUT:
+			nstate="IN_OUTPUT";
+			break;
 	}
 	printf(" state %s(%02x[%c]) -> %s\n",ostate,ch,yacli_isprint(ch)?ch:' ',nstate);
 #endif
@@ -1850,7 +5180,8 @@ static inline void yacli_replace(yacli *cli,int pos,int len,const char *word) {
 	if (!cli)
 		return;
 
-	if (yacli_buf_inc(&cli->buffer,&cli->bufsiz,&cli->buflen,1)) // assure buffer can hold what is needed
+	yacli_buf_flat(cli); // used by completion, which works on the whole line anyway
+	if (yacli_buf_inc(&cli->buffer,&cli->bufsiz,&cli->buflen,mymax(add,0)+1)) // assure buffer can hold the longer line and zero term
 		return;
 	memmove(cli->buffer+pos+wlen,cli->buffer+pos+len,cli->buflen-pos-len);
 	memcpy(cli->buffer+pos,word,wlen);
@@ -1885,6 +5216,7 @@ static inline void yacli_compact_spaces(yacli *cli) { // {{{
 	if (!cli)
 		return;
 
+	yacli_buf_flat(cli);
 	posd=0;
 	poss=0;
 
@@ -1909,6 +5241,8 @@ static inline void yacli_compact_spaces(yacli *cli) { // {{{
 		if (poss>=cli->buflen)
 			break;
 	}
+	if (cli->bufpos>cli->cursor) // visible part was removed, show the end of the line up to the cursor
+		cli->bufpos=mymax(0,cli->cursor-yacli_dispspace(cli)+1);
 } // }}}
 
 static inline int yacli_trycomplete(yacli *cli,int docomplete) { // {{{
@@ -2216,6 +5550,16 @@ static inline int yacli_trycomplete(yacli *cli,int docomplete) { // {{{
 				}
 
 				// now we have filter in f and params in word
+				if (docomplete==2&&f->check&&f->check(word)) {
+					yacli_print_nof(cli,"\nInvalid parameters for filter %s: %s\n",f->cmd,word);
+					cli->redraw=1;
+					cli->chaindone=1; // drop filters added so far without flushing them
+					yacli_free_fcmd(cli);
+					free(fb);
+					if (dyn)
+						yacli_dyn_vacuum(cli->cmdt);
+					return 0x80;
+				}
 				if (docomplete==2)
 					yacli_add_fcmd(cli,f,word);
 				word=nword;
@@ -2424,11 +5768,11 @@ donewithfilters:
 	return (!!completex)|((!!complete)<<1)|((!!canexalone<<2));
 } // }}}
 
-static inline void yacli_enter(yacli *cli) { // {{{
+static inline int yacli_enter(yacli *cli) { // {{{
 	int cmdok;
 
 	if (!cli)
-		return;
+		return 0;
 
 	// cmdok value:
 	// bit 0: last word was complete and executable
@@ -2437,9 +5781,11 @@ static inline void yacli_enter(yacli *cli) { // {{{
 	// bit 7: used internally to redraw prompt after enter on empty line
 	// bit 8: (set above) no matched command
 	cmdok=yacli_trycomplete(cli,2); // sets redraw in most cases
-	yacli_prompt(cli);
 	yacli_buf_zeroterm(cli);
-	yacli_add_hist(cli,cli->buffer);
+	if (!cli->pxrun) { // paste lines are not echoed and do not go to history
+		yacli_prompt(cli);
+		yacli_add_hist(cli,cli->buffer);
+	}
 	if (!cli->buflen) // allow pumping enter to reprint prompt
 		cmdok=0x40;
 	cli->retcode=YACLI_ERROR;
@@ -2462,14 +5808,38 @@ static inline void yacli_enter(yacli *cli) { // {{{
 			if (!cli->parsedcb)
 				yacli_print_nof(cli,"BUG: callback is NULL for valid command?!\n");
 			else {
+				if (cli->outfmt&&!yacli_table_rec(cli)) { // session output format goes first
+					filter_inst *fi=calloc(1,sizeof *fi);
+
+					if (fi)
+						fi->params=strdup("");
+					if (fi&&fi->params) {
+						fi->fltr=cli->outfmt;
+						fi->next=cli->fcmd;
+						cli->fcmd=fi;
+					} else if (fi)
+						free(fi);
+				}
+				// only worth it when there are filters; rows as records are passed on the loop thread; paste lines run one after another
+				if (cli->asyncout&&cli->fcmd!=&cli->noopi&&!yacli_table_rec(cli)&&!cli->pxrun)
+					yacli_opipe_start(cli);
 				cli->incmdcb=1;
 				cli->parsedcb(cli,cli->parsedcnt,cli->parsedcmd);
 				cli->incmdcb=0;
 			}
+			if (cli->tbl) // flush table that was not ended by the command
+				yacli_table_end(cli);
+			if (cli->opipe) { // filters go on in the worker, yacli_output_drain writes the rest and frees the chain
+				yacli_opipe_eof(cli);
+				if (cli->state==IN_NORM) // with more, it is entered when more ends
+					cli->state=IN_OUTPUT;
+				break;
+			}
 			yacli_free_fcmd(cli); // call done to flush the chain, then free chained filters
 			break;
 		case 0x40:
-			yacli_print(cli,"\n");
+			if (!cli->pxrun)
+				yacli_print(cli,"\n");
 			cli->retcode=YACLI_ENTER;
 			cli->redraw=1;
 			break;
@@ -2477,16 +5847,23 @@ static inline void yacli_enter(yacli *cli) { // {{{
 			break;
 	}
 	yacli_delall(cli);
+	return cmdok;
 } // }}}
 
 static inline void yacli_more_end(yacli *cli,more_type mt) { // {{{
 	if (!cli)
 		return;
 
+	if ((mt==MORE_QUIT||mt==MORE_CTRC)&&(cli->incmdcb||cli->opipe)) // user is not interested in the rest of the output
+		yacli_outdone_set(cli,1);
+	if (mt==MORE_CTRC&&cli->pastewait) { // nor in the rest of the paste
+		cli->pastewait=0;
+		cli->pastelen=0;
+	}
 	yacli_more_clear_prompt(cli,mt); // clear more prompt
 	cli->morelen=0;
 	cli->buffered=0;
-	cli->state=IN_NORM;
+	cli->state=cli->opipe?IN_OUTPUT:IN_NORM;
 	cli->redraw=1;
 } // }}}
 
@@ -2559,6 +5936,7 @@ static inline void yacli_ctrl_z(yacli *cli) { // {{{
 	if (!cli->handlectrlz)
 		return;
 
+	cli->scrok=0;
 	yascreen_puts(cli->s,"^Z\r\n");
 	if (cli->ctrlzcb)
 		cli->ctrlzcb(cli);
@@ -2580,10 +5958,195 @@ static inline void yacli_ctrl_z(yacli *cli) { // {{{
 		free(cli->savbuf);
 		cli->savbuf=NULL;
 	}
-	cli->hst_p=NULL; // reset history position
+	cli->hst_p=-1; // reset history position
 	yascreen_write(cli->s,"",0);
 } // }}}
 
+static const char yacli_pbeg[]="\e[200~"; // bracketed paste start marker
+static const char yacli_pend[]="\e[201~"; // bracketed paste end marker
+
+static inline void yacli_paste_app(yacli *cli,int key) { // {{{
+	// collect pasted key as text; tab is a blank, line feed after carriage return is one new line
+	char ch;
+
+	if (key==YAS_K_C_M||(key==YAS_K_C_J&&!(cli->pastelen&&cli->pastebuf[cli->pastelen-1]=='\r')))
+		ch='\r';
+	else if (key==YAS_K_TAB)
+		ch=' ';
+	else if (yacli_isprint(key))
+		ch=key;
+	else
+		return;
+	if (yacli_buf_inc(&cli->pastebuf,&cli->pastesiz,&cli->pastelen,1))
+		return;
+	cli->pastebuf[cli->pastelen++]=ch;
+} // }}}
+
+static inline void yacli_paste_done(yacli *cli) { // {{{
+	// insert pasted text at once, each new line enters the command
+	int errl[PASTE_ERRS],errb[PASTE_ERRS],erre[PASTE_ERRS];
+	int b=0,e,i,n=0,nerr=0;
+	int more=cli->more;
+
+	if (cli->pastexec&&memchr(cli->pastebuf,'\r',cli->pastelen)) { // execute lines at parser speed
+		yascreen_print(cli->s,"%s\r",yascreen_clearln_s(cli->s));
+		cli->scrok=0;
+		cli->more=0;
+		cli->pxrun=1;
+	}
+	for (e=0;e<cli->pastelen;e++) {
+		if (cli->pastebuf[e]!='\r')
+			continue;
+		yacli_insertn(cli,cli->pastebuf+b,e-b);
+		if (cli->pxrun) {
+			int cmdok=yacli_enter(cli);
+
+			n++;
+			if (cmdok<3||cmdok==0x80) {
+				if (nerr<PASTE_ERRS) {
+					errl[nerr]=n;
+					errb[nerr]=b;
+					erre[nerr]=e;
+				}
+				nerr++;
+			}
+			b=e+1;
+			if (cli->retcode==YACLI_EOF) // command asked to exit
+				break;
+			continue;
+		}
+		if (cli->redraw) // command line is shown before command output
+			yacli_prompt(cli);
+		yacli_enter(cli);
+		b=e+1;
+		if (cli->state!=IN_NORM) { // command output waits on more, keys go to it and the rest of the paste goes on after it
+			memmove(cli->pastebuf,cli->pastebuf+b,cli->pastelen-b);
+			cli->pastelen-=b;
+			cli->pastewait=1;
+			return;
+		}
+	}
+	if (cli->pxrun) {
+		cli->pxrun=0;
+		cli->more=more;
+		cli->lines=0; // paste output was not paged
+		if (cli->retcode==YACLI_EOF) {
+			cli->pastelen=0;
+			return;
+		}
+		yacli_print_nof(cli,"Pasted %d lines, %d failed\n",n,nerr);
+		for (i=0;i<nerr&&i<PASTE_ERRS;i++)
+			yacli_print_nof(cli,"  line %d: %.*s\n",errl[i],erre[i]-errb[i],cli->pastebuf+errb[i]);
+		if (nerr>PASTE_ERRS)
+			yacli_print_nof(cli,"  ...\n");
+		cli->redraw=1;
+	}
+	if (b<cli->pastelen)
+		yacli_insertn(cli,cli->pastebuf+b,cli->pastelen-b);
+	cli->pastelen=0;
+} // }}}
+
+static inline void yacli_paste_key(yacli *cli,int key) { // {{{
+	int i;
+
+	if (key==YAS_K_C_C) { // end marker was lost, drop the paste
+		cli->pastem=0;
+		cli->pastelen=0;
+		cli->state=IN_NORM;
+		yacli_ctrl_c(cli);
+		return;
+	}
+	if (key==(unsigned char)yacli_pend[cli->pastem]) {
+		if (!yacli_pend[++cli->pastem]) {
+			cli->pastem=0;
+			cli->state=IN_NORM;
+			yacli_paste_done(cli);
+		}
+		return;
+	}
+	for (i=0;i<cli->pastem;i++) // partial end marker was pasted text
+		yacli_paste_app(cli,(unsigned char)yacli_pend[i]);
+	cli->pastem=key==YAS_K_ESC;
+	if (!cli->pastem)
+		yacli_paste_app(cli,key);
+} // }}}
+
+static inline void yacli_typeahead(yacli *cli,int key) { // {{{
+	// keep key typed while command output is pending
+	if (cli->tkeyn==cli->tkeysiz) {
+		int ns=mymax(cli->tkeysiz*2,BUFFER_STEP);
+		int *t=realloc(cli->tkeys,ns*sizeof *t);
+
+		if (!t) // no memory, key is lost
+			return;
+		cli->tkeys=t;
+		cli->tkeysiz=ns;
+	}
+	cli->tkeys[cli->tkeyn++]=key;
+} // }}}
+
+static inline yacli_loop yacli_resume(yacli *cli) { // {{{
+	// command output has ended, go on with the rest of a paste and with keys typed meanwhile
+	yacli_loop rc=YACLI_LOOP;
+
+	if (cli->state!=IN_NORM||cli->opipe)
+		return rc;
+	if (cli->pastewait) {
+		cli->pastewait=0;
+		yacli_paste_done(cli);
+	}
+	if (cli->state==IN_NORM&&cli->tkeyn&&cli->retcode!=YACLI_EOF) { // keys may start another command, new ones are kept aside
+		int *t=cli->tkeys;
+		int n=cli->tkeyn;
+		int batch=cli->inbatch;
+
+		cli->tkeys=NULL;
+		cli->tkeyn=0;
+		cli->tkeysiz=0;
+		rc=yacli_keys(cli,t,n);
+		cli->inbatch=batch;
+		free(t);
+	}
+	return cli->retcode==YACLI_EOF?YACLI_EOF:rc;
+} // }}}
+
+inline yacli_loop yacli_output_drain(yacli *cli) { // {{{
+	// write output that the filter worker has handed back; when it is done, finish the command like yacli_key would
+	yacli_loop rc;
+
+	if (!cli)
+		return YACLI_ERROR;
+	if (!cli->opipe||cli->incmdcb)
+		return YACLI_LOOP;
+
+	if (yacli_opipe_poll(cli,0))
+		return YACLI_LOOP;
+	if (cli->state==IN_OUTPUT)
+		cli->state=IN_NORM;
+	cli->redraw=1;
+	rc=yacli_resume(cli);
+	if (rc==YACLI_EOF)
+		return rc;
+	if (!cli->inbatch) {
+		yacli_message_drain(cli);
+		if (cli->redraw)
+			yacli_prompt(cli);
+	}
+	return rc;
+} // }}}
+
+inline void yacli_set_output_fd(yacli *cli,int fd) { // {{{
+	if (!cli)
+		return;
+	cli->outfd=fd;
+} // }}}
+
+inline int yacli_output_pending(yacli *cli) { // {{{
+	if (!cli)
+		return 0;
+	return !!cli->opipe;
+} // }}}
+
 inline yacli_loop yacli_key(yacli *cli,int key) { // {{{
 	int enterinsearch=0;
 	yacli_in_state os;
@@ -2591,9 +6154,31 @@ inline yacli_loop yacli_key(yacli *cli,int key) { // {{{
 	if (!cli)
 		return YACLI_ERROR;
 
+	if (cli->opipe&&yacli_output_drain(cli)==YACLI_EOF) // keys typed ahead have ended the session
+		return YACLI_EOF;
 	os=cli->state;
 	cli->retcode=YACLI_LOOP;
 	switch (cli->state) {
+		case IN_ESC:
+			if (key==(unsigned char)yacli_pbeg[cli->pastem]) {
+				if (!yacli_pbeg[++cli->pastem]) {
+					cli->pastem=0;
+					cli->pastelen=0;
+					cli->state=IN_PASTE;
+				}
+				break;
+			} else { // not a paste, take keys after ESC as typed
+				int i;
+
+				for (i=1;i<cli->pastem;i++)
+					yacli_insert(cli,yacli_pbeg[i]);
+				cli->pastem=0;
+				cli->state=IN_NORM;
+				return yacli_key(cli,key);
+			}
+		case IN_PASTE:
+			yacli_paste_key(cli,key);
+			break;
 		case IN_MORE:
 			switch (key) {
 				case YAS_K_C_C: // ^C
@@ -2619,6 +6204,17 @@ inline yacli_loop yacli_key(yacli *cli,int key) { // {{{
 						yacli_more_line(cli);
 					break;
 			}
+			if (yacli_resume(cli)==YACLI_EOF)
+				return YACLI_EOF;
+			break;
+		case IN_OUTPUT:
+			if (key==YAS_K_C_C) { // cancel the output, keys typed ahead and the rest of a paste
+				cli->tkeyn=0;
+				cli->pastewait=0;
+				cli->pastelen=0;
+				yacli_ctrl_c(cli);
+			} else if (key!=YAS_TELNET_SIZE&&key!=YAS_SCREEN_SIZE)
+				yacli_typeahead(cli,key);
 			break;
 		case IN_SEARCH:
 			switch (key) {
@@ -2674,14 +6270,16 @@ inline yacli_loop yacli_key(yacli *cli,int key) { // {{{
 				cli->redraw=1;
 				break;
 			} else if (key==YAS_K_C_H) { // Ctrl-X Ctrl-H dump history
-				history *h=cli->hst;
+				int k;
 
+				yacli_hsh_pull(cli);
 				yacli_print(cli,"%s\rHistory dump:\n",yascreen_clearln_s(cli->s));
-				if (h)
-					do {
-						yacli_print(cli,"%s\r\n",h->command);
-						h=h->next;
-					} while (h!=cli->hst);
+				for (k=cli->hsthead;k!=-1;k=cli->hst[k].next) {
+					int len;
+					const char *c=yacli_hist_get(cli,k,&len);
+
+					yacli_print(cli,"%.*s\r\n",len,c);
+				}
 				cli->redraw=1;
 				break;
 			} else if (key==YAS_K_C_Z) { // Ctrl-X Ctrl-Z show terminal size
@@ -2757,6 +6355,10 @@ inline yacli_loop yacli_key(yacli *cli,int key) { // {{{
 					yacli_ctrl_z(cli);
 					break;
 				case YAS_K_ESC:
+					if (cli->state==IN_NORM) { // check for bracketed paste
+						cli->state=IN_ESC;
+						cli->pastem=1;
+					}
 					break;
 				case '?':
 					yacli_trycomplete(cli,0);
@@ -2813,30 +6415,106 @@ inline yacli_loop yacli_key(yacli *cli,int key) { // {{{
 			break;
 		case YAS_SCREEN_SIZE:
 			yascreen_getsize(cli->s,&cli->sx,&cli->sy);
+			yacli_gen_prompt(cli);
+			cli->scrok=0; // line may have wrapped
 			if (cli->showtsize)
 				yacli_print(cli,"%s\rTerminal size: %dx%d\n",yascreen_clearln_s(cli->s),cli->sx,cli->sy);
 			cli->redraw=1; // always redraw on screen size event
 			break;
 	}
+	if (cli->retcode!=YACLI_EOF&&!cli->inbatch) // messages posted while command or more was running
+		yacli_message_drain(cli);
 	debugstate(os,cli->state,key);
 	cli->wastab=key==YAS_K_TAB; // track double tab press
-	if (cli->redraw&&cli->retcode!=YACLI_EOF)
+	if (cli->redraw&&cli->retcode!=YACLI_EOF&&!cli->inbatch)
 		yacli_prompt(cli);
 	return cli->retcode;
 } // }}}
 
+static inline int yacli_editkey(yacli *cli,int key) { // {{{
+	// key only changes the line being edited, the prompt is not needed on screen before it
+	if (cli->state==IN_PASTE) // new lines in paste draw the line before enter
+		return 1;
+	if (cli->state!=IN_NORM&&cli->state!=IN_ESC)
+		return 0;
+
+	switch (key) {
+		case YAS_K_NUL:
+		case YAS_K_C_A:
+		case YAS_K_C_B:
+		case YAS_K_C_E:
+		case YAS_K_C_F:
+		case YAS_K_C_H:
+		case YAS_K_BSP:
+		case YAS_K_C_J:
+		case YAS_K_C_K:
+		case YAS_K_C_N:
+		case YAS_K_C_P:
+		case YAS_K_C_U:
+		case YAS_K_C_W:
+		case YAS_K_ESC:
+		case YAS_K_A_b:
+		case YAS_K_A_f:
+		case YAS_K_A_d:
+		case YAS_K_A_BSP:
+		case YAS_K_UP:
+		case YAS_K_DOWN:
+		case YAS_K_RIGHT:
+		case YAS_K_LEFT:
+		case YAS_K_HOME:
+		case YAS_K_END:
+		case YAS_K_DEL:
+		case YAS_K_C_RIGHT:
+		case YAS_K_C_LEFT:
+			return 1;
+		case '?':
+			return 0;
+		default:
+			return yacli_isprint(key);
+	}
+} // }}}
+
+inline yacli_loop yacli_keys(yacli *cli,const int *keys,size_t n) { // {{{
+	yacli_loop rc=YACLI_LOOP;
+	int entered=0;
+	size_t i;
+
+	if (!cli)
+		return YACLI_ERROR;
+
+	cli->inbatch=1;
+	for (i=0;i<n;i++) {
+		if (cli->redraw&&!yacli_editkey(cli,keys[i])) // show pending edits before output of this key
+			yacli_prompt(cli);
+		rc=yacli_key(cli,keys[i]);
+		if (rc==YACLI_ENTER)
+			entered=1;
+		if (rc==YACLI_EOF) // rest of the keys are dropped
+			break;
+	}
+	cli->inbatch=0;
+	if (rc==YACLI_EOF)
+		return rc;
+	yacli_message_drain(cli);
+	if (cli->redraw)
+		yacli_prompt(cli);
+	return entered?YACLI_ENTER:rc;
+} // }}}
+
 inline void yacli_start(yacli *cli) { // {{{
 	if (!cli)
 		return;
 
 	if (cli->istelnet) // setup telnet
 		yascreen_init_telnet(cli->s);
+	yascreen_puts(cli->s,"\e[?2004h"); // enable bracketed paste
 	yascreen_reqsize(cli->s); // request screen size update, regardless of operation mode
 	if (cli->banner&&strlen(cli->banner)) {
 		yascreen_puts(cli->s,"  \b\b\r"); // dirty hack for secure crt bug
 		yascreen_puts(cli->s,cli->banner);
 		yascreen_write(cli->s,"",0);
 	}
+	cli->scrok=0;
 	cli->redraw=1;
 } // }}}
 
@@ -2844,6 +6522,7 @@ inline void yacli_stop(yacli *cli) { // {{{
 	if (!cli)
 		return;
 
+	yascreen_puts(cli->s,"\e[?2004l"); // disable bracketed paste
 	if (cli->istelnet) { // revert telnet setup
 		yascreen_set_telnet(cli->s,0);
 		yascreen_init_telnet(cli->s);
@@ -2851,38 +6530,80 @@ inline void yacli_stop(yacli *cli) { // {{{
 } // }}}
 
 inline void yacli_free(yacli *cli) { // {{{
-	history *h;
-
 	if (!cli)
 		return;
 
+	if (cli->opipe) { // output of last command is still pending, stop its filters
+		yacli_outdone_set(cli,1);
+		yacli_opipe_poll(cli,1);
+	}
 	if (cli->buffer)
 		free(cli->buffer);
 	if (cli->hostname)
 		free(cli->hostname);
+	if (cli->modes)
+		free(cli->modes);
+	if (cli->pfx)
+		free(cli->pfx);
 	if (cli->banner)
 		free(cli->banner);
 	if (cli->level)
 		free(cli->level);
 	if (cli->savbuf)
 		free(cli->savbuf);
+	if (cli->sbuf)
+		free(cli->sbuf);
+	if (cli->scand)
+		free(cli->scand);
+	if (cli->hbucket)
+		free(cli->hbucket);
+	if (cli->htrie) {
+		int i;
+
+		for (i=0;i<cli->htrien;i++)
+			if (cli->htrie[i].ref)
+				free(cli->htrie[i].ref);
+		free(cli->htrie);
+	}
+	yacli_hsh_detach(cli);
+	if (cli->hshbuf)
+		free(cli->hshbuf);
 	if (cli->morebuf)
 		free(cli->morebuf);
 	if (cli->moreprompt)
 		free(cli->moreprompt);
-
-	if (cli->hst) {
-		h=cli->hst;
-		do {
-			history *t=h;
-
-			h=h->next;
-
-			free(t->command);
-			free(t);
-		} while (h!=cli->hst);
+	if (cli->fmtbuf)
+		free(cli->fmtbuf);
+	if (cli->outbuf)
+		free(cli->outbuf);
+	if (cli->pastebuf)
+		free(cli->pastebuf);
+	if (cli->tkeys)
+		free(cli->tkeys);
+	if (cli->scrbuf)
+		free(cli->scrbuf);
+	if (cli->scrnew)
+		free(cli->scrnew);
+	if (cli->msgbuf)
+		free(cli->msgbuf);
+	while (cli->inq) {
+		msgnode *n=cli->inq;
+
+		cli->inq=n->next;
+		free(n);
 	}
+
+	if (cli->hst)
+		free(cli->hst);
+	if (cli->harena)
+		free(cli->harena);
+	yacli_hist_unmap(cli);
+	if (cli->hfd!=-1)
+		close(cli->hfd);
+	if (cli->hpath)
+		free(cli->hpath);
 	yacli_cmd_free(cli->cmdt);
+	yacli_table_free(cli);
 	yacli_free_parsed(cli);
 	yacli_free_flts(cli);
 
@@ -2981,44 +6702,30 @@ inline void yacli_list(yacli *cli,void *ctx,const char *item) { // {{{
 	*place=t;
 } // }}}
 
-static inline void yacli_gen_modes(yacli *cli) { // {{{
-	int modelen=0;
-	cmstack *s,*l;
-	int first=1;
+static inline int yacli_push_modes(yacli *cli,cmstack *st) { // {{{
+	// "(mode1)" becomes "(mode1-mode2)"
+	int ml,len;
 
-	if (!cli)
-		return;
-
-	if (!cli->cstack) { // top mode
-		if (cli->modes)
-			free(cli->modes);
-		cli->modes=NULL;
-		return;
-	}
-
-	// calculate len
-	s=cli->cstack;
-	while (s) {
-		modelen+=1+strlen(s->mode); // open brace or dash+mode len
-		if (!s->next) // keep last element for reverse walk
-			l=s;
-		s=s->next;
-	}
-	if (cli->cstack) // closing brace
-		modelen++;
-
-	if (cli->modes)
-		free(cli->modes);
-	cli->modes=calloc(modelen+1,1);
-	if (!cli->modes) // crit - no memory
-		return;
+	st->modeoff=cli->modeslen?cli->modeslen-1:0; // drop closing brace; on error pop restores modes as they are
+	if (!st->mode)
+		return -1;
+	ml=strlen(st->mode);
+	len=st->modeoff;
+	if (yacli_buf_inc(&cli->modes,&cli->modessiz,&len,ml+2))
+		return -1;
+	cli->modes[len]=st->modeoff?'-':'(';
+	memcpy(cli->modes+len+1,st->mode,ml);
+	cli->modes[len+1+ml]=')';
+	cli->modeslen=len+ml+2;
+	return yacli_gen_prompt(cli);
+} // }}}
 
-	while (l) {
-		sprintf(cli->modes+strlen(cli->modes),"%c%s",first?'(':'-',l->mode);
-		l=l->prev;
-		first=0;
-	}
-	strcat(cli->modes,")");
+static inline void yacli_pop_modes(yacli *cli,cmstack *st) { // {{{
+	// "(mode1-mode2)" becomes "(mode1)"
+	cli->modeslen=st->modeoff;
+	if (cli->modeslen)
+		cli->modes[cli->modeslen++]=')';
+	yacli_gen_prompt(cli);
 } // }}}
 
 inline void yacli_enter_mode(yacli *cli,const char *mode,void *hint) { // {{{
@@ -3039,7 +6746,7 @@ inline void yacli_enter_mode(yacli *cli,const char *mode,void *hint) { // {{{
 	s->hint=hint;
 	cli->cmdt=NULL;
 	cli->cstack=s;
-	yacli_gen_modes(cli);
+	yacli_push_modes(cli,s);
 } // }}}
 
 inline void yacli_exit_mode(yacli *cli) { // {{{
@@ -3060,7 +6767,7 @@ inline void yacli_exit_mode(yacli *cli) { // {{{
 	if (cli->cstack)
 		cli->cstack->prev=NULL;
 
-	yacli_gen_modes(cli);
+	yacli_pop_modes(cli,s);
 	if (s->mode)
 		free(s->mode);
 	free(s);
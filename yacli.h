@@ -21,6 +21,7 @@
 #ifndef ___YACLI_H___
 #define ___YACLI_H___
 
+#include <sys/uio.h>
 #include <yascreen.h>
 
 #ifdef __cplusplus
@@ -34,6 +35,9 @@ typedef enum {
 	YACLI_EOF,
 } yacli_loop;
 
+// returned by yacli_print/yacli_write when command output is done or cancelled
+#define YACLI_OUTPUT_DONE (-2)
+
 struct _yacli;
 typedef struct _yacli yacli;
 
@@ -57,6 +61,21 @@ inline void yacli_set_telnet(yacli *cli,int on);
 inline void yacli_set_more(yacli *cli,int on);
 // set more prompt behaviour after line/page/continue/quit/^C
 inline void yacli_set_more_clear(yacli *cli,int ln,int pg,int co,int qu);
+// run output filters of a command in a worker thread, overlapped with the command callback;
+// the callback itself runs on the loop thread, after it the rest of the output comes through yacli_output_drain
+inline void yacli_set_async_output(yacli *cli,int on);
+// write output that the filter worker has handed back, finish the command when it is done; it is also done on each key
+inline yacli_loop yacli_output_drain(yacli *cli);
+// set fd (e.g. eventfd) that gets an 8 byte write when the filter worker has output for yacli_output_drain
+inline void yacli_set_output_fd(yacli *cli,int fd);
+// returns 1 while output of the last command is still coming from the filter worker
+inline int yacli_output_pending(yacli *cli);
+// set session output format: "json", "csv" or "text" (NULL); returns -1 for unknown format
+inline int yacli_set_output_format(yacli *cli,const char *fmt);
+// execute multi-line pastes line by line without echo and history, failed lines are listed after the paste
+inline void yacli_set_paste_exec(yacli *cli,int on);
+// set memory budget in bytes for the sort output filter (0 for default)
+inline void yacli_set_sort_mem(yacli *cli,size_t bytes);
 // enable ctrl-z handling (pops mode stack to top level)
 inline void yacli_set_ctrlz(yacli *cli,int on);
 inline void yacli_set_ctrlz_exec(yacli *cli,int on);
@@ -73,6 +92,8 @@ inline void yacli_start(yacli *cli);
 inline void yacli_stop(yacli *cli);
 // send input key to cli DFA
 inline yacli_loop yacli_key(yacli *cli,int key);
+// send multiple input keys (e.g. result of one read) with one prompt redraw after them; stops at EOF, returns YACLI_ENTER if a command was entered
+inline yacli_loop yacli_keys(yacli *cli,const int *keys,size_t n);
 // signal terminal size change
 inline void yacli_winch(yacli *cli);
 // signal cli to exit
@@ -81,11 +102,45 @@ inline void yacli_exit(yacli *cli);
 // filtered print, using print cb
 inline int yacli_print(yacli *cli,const char *format,...) __attribute__((format(printf,2,3)));
 inline int yacli_write(yacli *cli,const char *format,size_t len);
+// filtered write of multiple fragments (e.g. columns of a row) without joining them first
+inline int yacli_writev(yacli *cli,const struct iovec *iov,int iovcnt);
+// check if command output is done or cancelled (head filter, more quit, ^C); long running commands should stop early
+inline int yacli_output_done(yacli *cli);
+// table output: declare columns, push cells row by row, widths are calculated over a window of rows
+// with | json or | csv (or session output format) rows are passed as records and no text layout is made
+// all return 0 on success, YACLI_OUTPUT_DONE when output is done or cancelled and -1 on error
+inline int yacli_table_begin(yacli *cli);
+inline int yacli_table_col(yacli *cli,const char *name,int right);
+inline int yacli_table_str(yacli *cli,const char *val);
+inline int yacli_table_int(yacli *cli,long long val);
+inline int yacli_table_uint(yacli *cli,unsigned long long val);
+inline int yacli_table_row(yacli *cli);
+inline int yacli_table_end(yacli *cli);
 // unfiltered print for line messages (will clear the prompt, print the line and reprint prompt)
 inline void yacli_message(yacli *cli,const char *line);
+// queue messages until yacli_message_flush; allow up to rate messages per second (0 for unlimited), the rest are reported as suppressed
+inline void yacli_set_message_batch(yacli *cli,int on,int rate);
+// write queued messages with one prompt clear and one prompt redraw; call once per event loop tick
+inline void yacli_message_flush(yacli *cli);
+// thread safe message post; the message is shown by yacli_message_drain on the cli thread
+inline int yacli_message_post(yacli *cli,const char *line);
+// show posted messages (returns count); outside of commands and more it is also done after each key
+inline int yacli_message_drain(yacli *cli);
+// set fd (e.g. eventfd) that gets an 8 byte write when posted messages are waiting
+inline void yacli_set_message_fd(yacli *cli,int fd);
 
 // add command to history buffer
 inline int yacli_add_hist(yacli *cli,const char *buf);
+// set history capacity in commands (0 for default 1000), oldest commands are dropped
+inline int yacli_set_hist_size(yacli *cli,int n);
+// up/down browse only commands starting with the typed text (off by default)
+inline void yacli_set_hist_prefix(yacli *cli,int on);
+// keep only the newest copy of each command in history; a repeated command moves to the newest place and takes no capacity
+inline int yacli_set_hist_dedup(yacli *cli,int on);
+// share history with other sessions of this process (name NULL) or with processes using the same shm name
+inline int yacli_set_hist_shared(yacli *cli,int on,const char *name);
+// load history from file and append each new command to it, NULL to stop; file is compacted when it grows over maxsize (0 for no limit)
+inline int yacli_set_hist_file(yacli *cli,const char *path,size_t maxsize);
 // add part of command to command tree
 inline void *yacli_add_cmd(yacli *cli,void *parent,const char *cmd,const char *help,void (*cb)(yacli *cli,int cnt,char **cmd));
 // add item to dynamic list
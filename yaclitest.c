@@ -86,6 +86,27 @@ static void cmd_generic(yacli *cli,int cnt,char **cmd) {
 		yacli_print(cli,"some line #%d :)\n",i);
 }
 
+static void cmd_table(yacli *cli,int cnt,char **cmd) {
+	char s[50];
+	int i;
+
+	yacli_table_begin(cli);
+	yacli_table_col(cli,"Interface",0);
+	yacli_table_col(cli,"Packets",1);
+	yacli_table_col(cli,"Bytes",1);
+	yacli_table_col(cli,"State",0);
+	for (i=0;i<200;i++) {
+		snprintf(s,sizeof s,"eth%d.%04d",i%4,i);
+		yacli_table_str(cli,s);
+		yacli_table_uint(cli,i*7919ULL);
+		yacli_table_uint(cli,i*7919ULL*1400);
+		yacli_table_str(cli,i%3?"up":"down");
+		if (yacli_table_row(cli)) // output is done or cancelled
+			break;
+	}
+	yacli_table_end(cli);
+}
+
 static void list_cb(yacli *cli,void *ctx,int code) {
 	char s[50];
 	int i,j;
@@ -133,7 +154,7 @@ int main(void) {
 	time_t lastmsg=time(NULL);
 	void *ip3,*i3a,*i3b,*i3c;
 	void *ter,*no_ter;
-	unsigned char ch;
+	unsigned char ch[4096];
 	void *ip1,*ip2;
 	void *unprov;
 	void *pshow;
@@ -214,6 +235,7 @@ int main(void) {
 	yacli_add_cmd(cli,pshow,"pool","Display IP pool config",cmd_generic);
 	yacli_add_cmd(cli,pshow,"radius","Display radius config",cmd_generic);
 	yacli_add_cmd(cli,pshow,"watch","Display log show status",cmd_show_watch);
+	yacli_add_cmd(cli,pshow,"table","Display table output",cmd_table);
 
 	yacli_add_cmd(cli,pshow,"t123456a","test a",cmd_bliak);
 	yacli_add_cmd(cli,pshow,"t123456ab","test b",cmd_generic);
@@ -244,6 +266,9 @@ int main(void) {
 		struct timeval sto;
 		fd_set rfd={0};
 		yacli_loop rc;
+		int keys[4096];
+		size_t nk=0;
+		ssize_t rd;
 		int key;
 
 		if (winch) {
@@ -263,9 +288,10 @@ int main(void) {
 		sto.tv_usec=250*1000; // four times per sec
 		FD_ZERO(&rfd);
 		FD_SET(STDIN_FILENO,&rfd);
-		key=yascreen_getch_nowait(s);
-		if (key!=YAS_K_NONE) {
-			rc=yacli_key(cli,key);
+		while (nk<sizeof keys/sizeof *keys&&YAS_K_NONE!=(key=yascreen_getch_nowait(s))) // take all keys of last read
+			keys[nk++]=key;
+		if (nk) {
+			rc=yacli_keys(cli,keys,nk);
 			switch (rc) {
 				case YACLI_LOOP:
 				case YACLI_ENTER:
@@ -283,10 +309,15 @@ int main(void) {
 			continue;
 		if (!FD_ISSET(STDIN_FILENO,&rfd))
 			continue;
-		if (sizeof ch==read(STDIN_FILENO,&ch,sizeof ch)) {
-			if (ch==0x0a) // translate enter to telnet code
-				ch=0x0d;
-			yascreen_feed(s,ch);
+		rd=read(STDIN_FILENO,ch,sizeof ch);
+		if (rd>0) {
+			ssize_t i;
+
+			for (i=0;i<rd;i++) {
+				if (ch[i]==0x0a) // translate enter to telnet code
+					ch[i]=0x0d;
+				yascreen_feed(s,ch[i]);
+			}
 		} else {
 			yacli_print(cli,"got strange result\n");
 			break;